@@ -0,0 +1,364 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                   addrhash.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   An open addressing hash table keyed directly by addresses, with the
+   key and the value stored inline in each slot. The table size is a
+   power of two, the slot is found with a multiplicative (fibonacci)
+   hash and collisions are resolved with linear probing.
+
+   When the load goes above 70% the table doubles, but the entries are
+   moved incrementally: the old table is kept aside and every operation
+   migrates a few of its slots until it is empty. Lookups that miss the
+   new table also probe the unmigrated part of the old one.
+*/
+
+#define MIGRATE_STEP 64 // old slots migrated per operation
+
+// Marks a slot of the old table that was migrated or removed, so the
+// probing sequences that go through it are kept intact.
+#define MOVED_VALUE ((void*) 1)
+
+typedef struct _AddrSlot	AddrSlot;
+struct _AddrSlot {
+	Addr key;
+	void* value; // 0 if the slot is empty.
+};
+
+struct _AddrHash {
+	Int count;
+	Int bits;
+	Int size;
+	AddrSlot* table;
+
+	// Previous table, being migrated to the current one.
+	Int old_bits;
+	Int old_size;
+	Int old_next;
+	AddrSlot* old_table;
+};
+
+static __inline__
+Int slot_index(Addr key, Int bits) {
+#if VG_WORDSIZE == 8
+	return (Int) ((((ULong) key) * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+#else
+	return (Int) ((((UInt) key) * 0x9E3779B9U) >> (32 - bits));
+#endif
+}
+
+static
+AddrSlot* new_table(Int size) {
+	AddrSlot* table;
+
+	table = (AddrSlot*) IGD_MALLOC("igd.addrhash.nt.1", (size * sizeof(AddrSlot)));
+	VG_(memset)(table, 0, (size * sizeof(AddrSlot)));
+
+	return table;
+}
+
+// Insert a key known not to be in the current table.
+static
+void insert_slot(AddrHash* ahash, Addr key, void* value) {
+	Int idx, mask;
+
+	mask = ahash->size - 1;
+	idx = slot_index(key, ahash->bits);
+	while (ahash->table[idx].value != 0)
+		idx = (idx + 1) & mask;
+
+	ahash->table[idx].key = key;
+	ahash->table[idx].value = value;
+}
+
+static
+AddrSlot* find_slot(AddrSlot* table, Int bits, Int size, Addr key) {
+	Int idx, mask;
+
+	mask = size - 1;
+	idx = slot_index(key, bits);
+	while (table[idx].value != 0) {
+		if (table[idx].key == key && table[idx].value != MOVED_VALUE)
+			return &(table[idx]);
+
+		idx = (idx + 1) & mask;
+	}
+
+	return 0;
+}
+
+// Remove the slot in the current table, shifting back the following
+// entries of the cluster so no tombstones are needed.
+static
+void remove_slot(AddrHash* ahash, Int idx) {
+	Int next, home, mask;
+
+	mask = ahash->size - 1;
+	next = (idx + 1) & mask;
+	while (ahash->table[next].value != 0) {
+		home = slot_index(ahash->table[next].key, ahash->bits);
+
+		// Move it only if its home is not cyclically in (idx, next].
+		if (((next - home) & mask) >= ((next - idx) & mask)) {
+			ahash->table[idx] = ahash->table[next];
+			idx = next;
+		}
+
+		next = (next + 1) & mask;
+	}
+
+	ahash->table[idx].key = 0;
+	ahash->table[idx].value = 0;
+}
+
+static
+void migrate_slots(AddrHash* ahash, Int step) {
+	AddrSlot* slot;
+
+	if (!ahash->old_table)
+		return;
+
+	while (step-- > 0 && ahash->old_next < ahash->old_size) {
+		slot = &(ahash->old_table[ahash->old_next++]);
+		if (slot->value != 0 && slot->value != MOVED_VALUE) {
+			insert_slot(ahash, slot->key, slot->value);
+			slot->value = MOVED_VALUE;
+		}
+	}
+
+	if (ahash->old_next == ahash->old_size) {
+		IGD_FREE(ahash->old_table);
+
+		ahash->old_table = 0;
+		ahash->old_bits = 0;
+		ahash->old_size = 0;
+		ahash->old_next = 0;
+	}
+}
+
+static
+void grow_addr_hash(AddrHash* ahash) {
+	// Finish any pending migration before starting a new one.
+	if (ahash->old_table)
+		migrate_slots(ahash, ahash->old_size);
+
+	IGD_ASSERT(ahash->old_table == 0);
+
+	ahash->old_bits = ahash->bits;
+	ahash->old_size = ahash->size;
+	ahash->old_next = 0;
+	ahash->old_table = ahash->table;
+
+	ahash->bits++;
+	ahash->size <<= 1;
+	ahash->table = new_table(ahash->size);
+}
+
+AddrHash* IGD_(new_addr_hash)(Int size) {
+	AddrHash* ahash;
+
+	IGD_ASSERT(size > 0);
+
+	ahash = (AddrHash*) IGD_MALLOC("igd.addrhash.nah.1", sizeof(AddrHash));
+	VG_(memset)(ahash, 0, sizeof(AddrHash));
+
+	// Round it up to a power of two.
+	ahash->bits = 1;
+	while ((1 << ahash->bits) < size)
+		ahash->bits++;
+
+	ahash->size = 1 << ahash->bits;
+	ahash->table = new_table(ahash->size);
+
+	return ahash;
+}
+
+void IGD_(delete_addr_hash)(AddrHash* ahash) {
+	IGD_ASSERT(ahash != 0);
+	IGD_ASSERT(ahash->count == 0);
+
+	if (ahash->old_table)
+		IGD_FREE(ahash->old_table);
+
+	IGD_FREE(ahash->table);
+	IGD_DATA_FREE(ahash, sizeof(AddrHash));
+}
+
+void IGD_(addr_hash_clear)(AddrHash* ahash, void (*remove_value)(void*)) {
+	Int idx;
+
+	IGD_ASSERT(ahash != 0);
+
+	// Simplify things by finishing the migration.
+	migrate_slots(ahash, ahash->old_size);
+
+	if (remove_value) {
+		for (idx = 0; idx < ahash->size; idx++) {
+			if (ahash->table[idx].value != 0)
+				(*remove_value)(ahash->table[idx].value);
+		}
+	}
+
+	VG_(memset)(ahash->table, 0, (ahash->size * sizeof(AddrSlot)));
+	ahash->count = 0;
+}
+
+Int IGD_(addr_hash_count)(AddrHash* ahash) {
+	IGD_ASSERT(ahash != 0);
+	return ahash->count;
+}
+
+Int IGD_(addr_hash_size)(AddrHash* ahash) {
+	IGD_ASSERT(ahash != 0);
+	return ahash->size;
+}
+
+Bool IGD_(addr_hash_is_empty)(AddrHash* ahash) {
+	IGD_ASSERT(ahash != 0);
+	return ahash->count == 0;
+}
+
+void* IGD_(addr_hash_get)(AddrHash* ahash, Addr key) {
+	AddrSlot* slot;
+
+	IGD_ASSERT(ahash != 0);
+
+	slot = find_slot(ahash->table, ahash->bits, ahash->size, key);
+	if (slot)
+		return slot->value;
+
+	if (ahash->old_table) {
+		slot = find_slot(ahash->old_table, ahash->old_bits, ahash->old_size, key);
+		if (slot)
+			return slot->value;
+	}
+
+	// Not found.
+	return 0;
+}
+
+void* IGD_(addr_hash_put)(AddrHash* ahash, Addr key, void* value) {
+	void* old;
+	AddrSlot* slot;
+
+	IGD_ASSERT(ahash != 0);
+	IGD_ASSERT(value != 0 && value != MOVED_VALUE);
+
+	migrate_slots(ahash, MIGRATE_STEP);
+
+	slot = find_slot(ahash->table, ahash->bits, ahash->size, key);
+	if (slot) {
+		// Replace with the new value and return the old one.
+		old = slot->value;
+		slot->value = value;
+		return old;
+	}
+
+	if (ahash->old_table) {
+		slot = find_slot(ahash->old_table, ahash->old_bits, ahash->old_size, key);
+		if (slot) {
+			old = slot->value;
+			slot->value = MOVED_VALUE;
+
+			insert_slot(ahash, key, value);
+			return old;
+		}
+	}
+
+	if ((10 * (ahash->count + 1)) > (7 * ahash->size))
+		grow_addr_hash(ahash);
+
+	insert_slot(ahash, key, value);
+	++ahash->count;
+
+	return 0;
+}
+
+void* IGD_(addr_hash_remove)(AddrHash* ahash, Addr key) {
+	void* old;
+	AddrSlot* slot;
+
+	IGD_ASSERT(ahash != 0);
+
+	migrate_slots(ahash, MIGRATE_STEP);
+
+	slot = find_slot(ahash->table, ahash->bits, ahash->size, key);
+	if (slot) {
+		old = slot->value;
+		remove_slot(ahash, slot - ahash->table);
+		--ahash->count;
+
+		return old;
+	}
+
+	if (ahash->old_table) {
+		slot = find_slot(ahash->old_table, ahash->old_bits, ahash->old_size, key);
+		if (slot) {
+			old = slot->value;
+			slot->value = MOVED_VALUE;
+			--ahash->count;
+
+			return old;
+		}
+	}
+
+	return 0;
+}
+
+Bool IGD_(addr_hash_contains)(AddrHash* ahash, Addr key) {
+	return IGD_(addr_hash_get)(ahash, key) != 0;
+}
+
+void IGD_(addr_hash_forall)(AddrHash* ahash, Bool (*func)(void*, void*), void* arg) {
+	Int start, idx, n, mask;
+
+	IGD_ASSERT(ahash != 0);
+	IGD_ASSERT(func != 0);
+
+	migrate_slots(ahash, ahash->old_size);
+
+	// Start right after an empty slot, so removing an entry only shifts
+	// back entries that were not visited yet.
+	mask = ahash->size - 1;
+	start = 0;
+	while (ahash->table[start].value != 0)
+		start++;
+
+	idx = (start + 1) & mask;
+	for (n = 0; n < ahash->size; n++) {
+		while (ahash->table[idx].value != 0 &&
+				(*func)(ahash->table[idx].value, arg)) {
+			remove_slot(ahash, idx);
+			--ahash->count;
+		}
+
+		idx = (idx + 1) & mask;
+	}
+}
@@ -0,0 +1,506 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                  aggregate.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Coarser profiles than the instructions, for the consumers that do not
+   need them one by one, written at the end of the run:
+
+   --groups-outfile: the counts of the groups of instructions between the
+     side exits of the superblocks, "0xaddr:ninstrs:count[:gen]" lines
+     sorted by address. They are accumulated when the groups are flushed,
+     since the groups themselves are deleted with their superblocks.
+   --funcs-outfile: the instructions executed per function, as
+     "0xentry:ninstrs:count:name" lines with the most executed first. The
+     entry is the start of the function symbol, or the lowest executed
+     address of the code with no symbol.
+   --objs-outfile: the same per object (binary or library), as
+     "0xtext:ninstrs:count:filename" lines.
+
+   The functions and objects are found walking the instructions sorted by
+   address, so each symbol and text range is looked up only once: the
+   ranges of the functions of an object are read from its symbol table
+   the first time it is reached, and the code outside of the objects is
+   looked up once per range between their texts.
+*/
+
+#define GROUPS_POOL_SIZE 16384
+#define GROUPS_PER_SLAB 4096
+#define STATS_INITIAL 256
+
+typedef struct _GroupStat	GroupStat;
+struct _GroupStat {
+	UniqueInstr* first;
+	Int ninstrs;
+	ULong count;
+	GroupStat* next; // Another group with the same first instruction.
+};
+
+typedef struct _FuncRange	FuncRange;
+struct _FuncRange {
+	Addr start;
+	SizeT size;
+};
+
+typedef struct _ProfileTable	ProfileTable;
+struct _ProfileTable {
+	ProfileStat* stats;
+	Int count;
+	Int max;
+};
+
+static AddrHash* group_stats = 0; // UniqueInstr* (first) -> GroupStat*
+static Slab* group_slab = 0;
+
+void IGD_(init_aggregates)(void) {
+	IGD_ASSERT(group_stats == 0);
+
+	if (IGD_(clo).groups_outfile) {
+		group_stats = IGD_(new_addr_hash)(GROUPS_POOL_SIZE);
+		group_slab = IGD_(new_slab)("igd.aggregate.ia.1", sizeof(GroupStat), GROUPS_PER_SLAB);
+	}
+}
+
+void IGD_(destroy_aggregates)(void) {
+	if (group_stats) {
+		// The stats are released all at once with the slab.
+		IGD_(addr_hash_clear)(group_stats, 0);
+		IGD_(delete_addr_hash)(group_stats);
+		group_stats = 0;
+
+		IGD_(delete_slab)(group_slab);
+		group_slab = 0;
+	}
+}
+
+// Accumulate the count of the group, before it is flushed.
+void IGD_(aggregate_group)(InstrGroup* group) {
+	Int ninstrs;
+	UniqueInstr* first;
+	GroupStat* head;
+	GroupStat* stat;
+
+	if (!group_stats || group->exec_count == 0)
+		return;
+
+	ninstrs = group->ninstrs;
+	if (ninstrs == 0)
+		return;
+
+	first = group->instrs[0];
+	head = (GroupStat*) IGD_(addr_hash_get)(group_stats, (Addr) first);
+	for (stat = head; stat; stat = stat->next) {
+		if (stat->ninstrs == ninstrs)
+			break;
+	}
+
+	if (!stat) {
+		stat = (GroupStat*) IGD_(slab_alloc)(group_slab);
+		stat->first = first;
+		stat->ninstrs = ninstrs;
+		stat->count = 0;
+		stat->next = head;
+
+		IGD_(addr_hash_put)(group_stats, (Addr) first, stat);
+	}
+
+	stat->count += group->exec_count;
+}
+
+static
+void release_group_stat(GroupStat* stat) {
+	GroupStat* next;
+
+	while (stat) {
+		next = stat->next;
+		IGD_(slab_free)(group_slab, stat);
+		stat = next;
+	}
+}
+
+void IGD_(zero_aggregates)(void) {
+	if (group_stats)
+		IGD_(addr_hash_clear)(group_stats, (void (*)(void*)) release_group_stat);
+}
+
+static
+Bool scale_group_stat(GroupStat* head, void* arg) {
+	GroupStat* stat;
+
+	for (stat = head; stat; stat = stat->next)
+		stat->count = IGD_(sampled_count)(stat->count);
+
+	return False;
+}
+
+// Scale the group counts of a sampled run (sampling.c).
+void IGD_(scale_aggregates)(void) {
+	if (group_stats)
+		IGD_(addr_hash_forall)(group_stats, (Bool (*)(void*, void*)) scale_group_stat, 0);
+}
+
+static
+Bool collect_group_stat(GroupStat* head, GroupStat*** next) {
+	GroupStat* stat;
+
+	for (stat = head; stat; stat = stat->next)
+		*((*next)++) = stat;
+
+	return False;
+}
+
+static
+Int cmp_group_stats(const void* p1, const void* p2) {
+	const GroupStat* g1 = *((const GroupStat* const*) p1);
+	const GroupStat* g2 = *((const GroupStat* const*) p2);
+	Int r;
+
+	r = IGD_(cmp_instrs_addr)(&g1->first, &g2->first);
+	if (r != 0)
+		return r;
+
+	return g1->ninstrs < g2->ninstrs ? -1 : (g1->ninstrs > g2->ninstrs ? 1 : 0);
+}
+
+// The groups must be flushed already.
+void IGD_(dump_groups)(const HChar* filename) {
+	Int i, count;
+	GroupStat** stats;
+	GroupStat** next;
+	FileWriter* fw;
+
+	IGD_ASSERT(group_stats != 0);
+
+	count = IGD_(slab_count)(group_slab);
+	stats = (GroupStat**) IGD_MALLOC("igd.aggregate.dg.1",
+						((count + 1) * sizeof(GroupStat*)));
+
+	next = stats;
+	IGD_(addr_hash_forall)(group_stats, (Bool (*)(void*, void*)) collect_group_stat, &next);
+	IGD_ASSERT((next - stats) == count);
+
+	VG_(ssort)(stats, count, sizeof(GroupStat*), cmp_group_stats);
+
+	fw = IGD_(new_file_writer)(filename);
+	for (i = 0; i < count; i++)
+		IGD_(write_text_record)(fw, -1, stats[i]->first->addr, stats[i]->ninstrs,
+			stats[i]->first->gen, stats[i]->count);
+	IGD_(delete_file_writer)(fw);
+
+	IGD_FREE(stats);
+}
+
+static
+void add_profile(ProfileTable* table, const HChar* name, Addr addr) {
+	ProfileStat* stat;
+
+	if (table->count == table->max) {
+		table->max = table->max ? (table->max * 2) : STATS_INITIAL;
+		table->stats = (ProfileStat*) IGD_REALLOC("igd.aggregate.ap.1",
+							table->stats, (table->max * sizeof(ProfileStat)));
+	}
+
+	stat = &table->stats[table->count++];
+	stat->name = VG_(strdup)("igd.aggregate.ap.2", name);
+	stat->addr = addr;
+	stat->ninstrs = 0;
+	stat->count = 0;
+}
+
+static
+Int cmp_profile_stats(const void* p1, const void* p2) {
+	const ProfileStat* s1 = (const ProfileStat*) p1;
+	const ProfileStat* s2 = (const ProfileStat*) p2;
+
+	if (s1->count != s2->count)
+		return s1->count > s2->count ? -1 : 1;
+
+	return s1->addr < s2->addr ? -1 : (s1->addr > s2->addr ? 1 : 0);
+}
+
+// Write the table, the most executed first.
+static
+void dump_profile(const HChar* filename, ProfileTable* table) {
+	Int i;
+	FileWriter* fw;
+
+	VG_(ssort)(table->stats, table->count, sizeof(ProfileStat), cmp_profile_stats);
+
+	fw = IGD_(new_file_writer)(filename);
+	for (i = 0; i < table->count; i++) {
+		ProfileStat* stat = &table->stats[i];
+
+		IGD_(file_writer_bytes)(fw, "0x", 2);
+		IGD_(file_writer_hex)(fw, stat->addr);
+		IGD_(file_writer_char)(fw, ':');
+		IGD_(file_writer_dec)(fw, stat->ninstrs);
+		IGD_(file_writer_char)(fw, ':');
+		IGD_(file_writer_dec)(fw, stat->count);
+		IGD_(file_writer_char)(fw, ':');
+		IGD_(file_writer_bytes)(fw, stat->name, VG_(strlen)(stat->name));
+		IGD_(file_writer_char)(fw, '\n');
+	}
+	IGD_(delete_file_writer)(fw);
+}
+
+void IGD_(delete_profiles)(ProfileStat* stats, Int count) {
+	Int i;
+
+	for (i = 0; i < count; i++)
+		IGD_FREE(stats[i].name);
+
+	if (stats)
+		IGD_FREE(stats);
+}
+
+static
+Int cmp_func_ranges(const void* p1, const void* p2) {
+	const FuncRange* r1 = (const FuncRange*) p1;
+	const FuncRange* r2 = (const FuncRange*) p2;
+
+	return r1->start < r2->start ? -1 : (r1->start > r2->start ? 1 : 0);
+}
+
+// The text symbols of the object, sorted by address.
+static
+FuncRange* read_func_ranges(const DebugInfo* di, Int* count) {
+	Int i, n, total;
+	UInt size;
+	Bool is_text;
+	SymAVMAs avmas;
+	FuncRange* ranges;
+
+	total = VG_(DebugInfo_syms_howmany)(di);
+	ranges = (FuncRange*) IGD_MALLOC("igd.aggregate.rfr.1",
+						((total + 1) * sizeof(FuncRange)));
+
+	n = 0;
+	for (i = 0; i < total; i++) {
+		VG_(DebugInfo_syms_getidx)(di, i, &avmas, &size, 0, 0, &is_text, 0, 0);
+		if (!is_text || size == 0)
+			continue;
+
+		ranges[n].start = avmas.main;
+		ranges[n].size = size;
+		n++;
+	}
+
+	VG_(ssort)(ranges, n, sizeof(FuncRange), cmp_func_ranges);
+
+	*count = n;
+	return ranges;
+}
+
+// The range of the function with the address, or -1.
+static
+Int find_func_range(FuncRange* ranges, Int count, Addr addr) {
+	Int lo, hi, mid;
+
+	lo = 0;
+	hi = count - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (addr < ranges[mid].start)
+			hi = mid - 1;
+		else if (addr >= (ranges[mid].start + ranges[mid].size))
+			lo = mid + 1;
+		else
+			return mid;
+	}
+
+	return -1;
+}
+
+// The range around the address with no object text.
+static
+void find_text_gap(Addr addr, Addr* start, Addr* end) {
+	Addr text, text_end;
+	const DebugInfo* di;
+
+	*start = 0;
+	*end = ~((Addr) 0);
+	for (di = VG_(next_DebugInfo)(0); di; di = VG_(next_DebugInfo)(di)) {
+		text = VG_(DebugInfo_get_text_avma)(di);
+		if (!text)
+			continue;
+
+		text_end = text + VG_(DebugInfo_get_text_size)(di);
+		if (text_end <= addr && text_end > *start)
+			*start = text_end;
+		else if (text > addr && text < *end)
+			*end = text;
+	}
+}
+
+// Compute the objects profiles and, if funcs is not null, the functions
+// ones. The groups must be flushed already.
+static
+void compute_profiles(ProfileTable* funcs, ProfileTable* objs) {
+	Int i, count, nranges, range;
+	Addr obj_start, obj_end, fn_start, fn_end;
+	DiEpoch ep;
+	const HChar* name;
+	const DebugInfo* di;
+	FuncRange* ranges;
+	UniqueInstr** instrs;
+	UniqueInstr* instr;
+	Int obj, fn, unknown_obj, unknown_fn, outside_fn;
+
+	instrs = IGD_(sorted_instrs)(&count);
+
+	ep = VG_(current_DiEpoch)();
+
+	ranges = 0;
+	nranges = 0;
+	obj = fn = -1;
+	unknown_obj = unknown_fn = outside_fn = -1;
+	obj_start = obj_end = fn_start = fn_end = 0;
+	for (i = 0; i < count; i++) {
+		instr = instrs[i];
+		if (instr->exec_count == 0)
+			continue;
+
+		// A new object, or code outside of any.
+		if (instr->addr < obj_start || instr->addr >= obj_end) {
+			di = VG_(find_DebugInfo)(ep, instr->addr);
+			if (di && VG_(DebugInfo_get_text_avma)(di) &&
+					instr->addr >= VG_(DebugInfo_get_text_avma)(di) &&
+					instr->addr < (VG_(DebugInfo_get_text_avma)(di) +
+									VG_(DebugInfo_get_text_size)(di))) {
+				obj_start = VG_(DebugInfo_get_text_avma)(di);
+				obj_end = obj_start + VG_(DebugInfo_get_text_size)(di);
+
+				add_profile(objs, VG_(DebugInfo_get_filename)(di), obj_start);
+				obj = objs->count - 1;
+
+				if (ranges)
+					IGD_FREE(ranges);
+				ranges = funcs ? read_func_ranges(di, &nranges) : 0;
+
+				fn_start = fn_end = 0;
+				unknown_fn = -1;
+			} else {
+				if (unknown_obj < 0) {
+					add_profile(objs, "???", instr->addr);
+					unknown_obj = objs->count - 1;
+				}
+
+				// The following code up to the next object is
+				// outside of them too.
+				obj = unknown_obj;
+				find_text_gap(instr->addr, &obj_start, &obj_end);
+
+				if (ranges)
+					IGD_FREE(ranges);
+				ranges = 0;
+				nranges = 0;
+			}
+		}
+
+		objs->stats[obj].ninstrs++;
+		objs->stats[obj].count += instr->exec_count;
+
+		if (!funcs)
+			continue;
+
+		// A new function, or code with no symbol in the object.
+		if (instr->addr < fn_start || instr->addr >= fn_end) {
+			range = ranges ? find_func_range(ranges, nranges, instr->addr) : -1;
+			if (range >= 0) {
+				fn_start = ranges[range].start;
+				fn_end = fn_start + ranges[range].size;
+
+				if (!VG_(get_fnname)(ep, fn_start, &name))
+					name = "???";
+
+				add_profile(funcs, name, fn_start);
+				fn = funcs->count - 1;
+			} else {
+				// One entry for the code with no symbol of each object,
+				// and one for the code outside of the objects.
+				if (obj == unknown_obj) {
+					if (outside_fn < 0) {
+						add_profile(funcs, "???", instr->addr);
+						outside_fn = funcs->count - 1;
+					}
+
+					fn = outside_fn;
+				} else {
+					if (unknown_fn < 0) {
+						add_profile(funcs, "???", instr->addr);
+						unknown_fn = funcs->count - 1;
+					}
+
+					fn = unknown_fn;
+				}
+				fn_start = fn_end = 0;
+			}
+		}
+
+		funcs->stats[fn].ninstrs++;
+		funcs->stats[fn].count += instr->exec_count;
+	}
+
+	if (ranges)
+		IGD_FREE(ranges);
+	IGD_FREE(instrs);
+}
+
+// Dump the functions and objects profiles (any of the files may be
+// null). The groups must be flushed already.
+void IGD_(dump_funcs_objs)(const HChar* funcs_filename, const HChar* objs_filename) {
+	ProfileTable funcs = { 0, 0, 0 };
+	ProfileTable objs = { 0, 0, 0 };
+
+	compute_profiles(funcs_filename ? &funcs : 0, &objs);
+
+	if (funcs_filename) {
+		dump_profile(funcs_filename, &funcs);
+		IGD_(delete_profiles)(funcs.stats, funcs.count);
+	}
+
+	if (objs_filename)
+		dump_profile(objs_filename, &objs);
+	IGD_(delete_profiles)(objs.stats, objs.count);
+}
+
+// The functions profiles, the most executed first, to be released with
+// IGD_(delete_profiles).
+ProfileStat* IGD_(func_profiles)(Int* count) {
+	ProfileTable funcs = { 0, 0, 0 };
+	ProfileTable objs = { 0, 0, 0 };
+
+	compute_profiles(&funcs, &objs);
+	IGD_(delete_profiles)(objs.stats, objs.count);
+
+	VG_(ssort)(funcs.stats, funcs.count, sizeof(ProfileStat), cmp_profile_stats);
+
+	*count = funcs.count;
+	return funcs.stats;
+}
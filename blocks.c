@@ -0,0 +1,286 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                     blocks.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+#define DEFAULT_POOL_SIZE 65536 // 64k superblocks
+#define BLOCKS_PER_SLAB 8192
+
+// Superblocks by their guest entry address (vge->base[0]). An address can
+// have many translations at once (no-redir ones, for example), and valgrind
+// does not tell which one it discards, nor reports all the discards, so a
+// single block keeps the groups of all of them, with the count of their
+// translations. The groups are only released when the count drops to zero,
+// so no running translation increments the counters of recycled groups.
+AddrHash* blocks_pool = 0;
+Slab* blocks_slab = 0;
+
+// Superblocks executed since the last snapshot (snapshot.c), so only
+// their groups need to be flushed. Discarded entries are nulled.
+static InstrBlock** touched_blocks = 0;
+static Int touched_count = 0;
+static Int touched_size = 0;
+
+// Number of counter increments executed by the superblocks already
+// discarded, to compare the counting schemes.
+static ULong counter_increments = 0;
+
+/*
+   With --exit-counters=yes the first group of a superblock counts its
+   entries, and each of the following groups counts how many times the
+   side exit before it was taken. The instructions of a group are then
+   executed as many times as the superblock was entered minus the exits
+   taken up to it, so the execution counts are derived by subtraction. The
+   groups of each translation start with an entry group.
+*/
+static
+void collect_block_counts(InstrBlock* block) {
+	ULong running;
+	InstrGroup* group;
+
+	if (IGD_(clo).separate_threads)
+		IGD_(flush_thread_block)(block);
+
+	running = 0;
+	for (group = block->groups; group; group = group->next) {
+		if (!IGD_(clo).separate_threads)
+			group->exec_count += IGD_(take_counter)(group->id);
+
+		counter_increments += group->exec_count;
+
+		if (!IGD_(clo).exit_counters)
+			continue;
+
+		if (group->entry)
+			running = group->exec_count;
+		else
+			running -= group->exec_count;
+
+		group->exec_count = running;
+	}
+}
+
+static
+void delete_block(InstrBlock* block) {
+	InstrGroup* group;
+
+	IGD_ASSERT(block != 0);
+
+	collect_block_counts(block);
+
+	if (block->touched) {
+		touched_blocks[block->touched - 1] = 0;
+
+		for (group = block->groups; group; group = group->next)
+			IGD_(snapshot_group)(group);
+	}
+
+	group = block->groups;
+	while (group) {
+		InstrGroup* tmp = group->next;
+		IGD_(delete_group)(group);
+		group = tmp;
+	}
+
+	IGD_(slab_free)(blocks_slab, block);
+}
+
+void IGD_(init_blocks_pool)() {
+	IGD_ASSERT(blocks_pool == 0);
+	IGD_ASSERT(blocks_slab == 0);
+
+	blocks_pool = IGD_(new_addr_hash)(DEFAULT_POOL_SIZE);
+	blocks_slab = IGD_(new_slab)("igd.blocks.nb.1", sizeof(InstrBlock), BLOCKS_PER_SLAB);
+
+	touched_count = 0;
+	touched_size = 1024;
+	touched_blocks = (InstrBlock**) IGD_MALLOC("igd.blocks.nb.2",
+								(touched_size * sizeof(InstrBlock*)));
+}
+
+// Flush and release the groups of all superblocks still translated.
+void IGD_(destroy_blocks_pool)() {
+	IGD_ASSERT(blocks_pool != 0);
+	IGD_ASSERT(blocks_slab != 0);
+
+	IGD_(addr_hash_clear)(blocks_pool, (void (*)(void*)) delete_block);
+	IGD_(delete_addr_hash)(blocks_pool);
+	blocks_pool = 0;
+
+	IGD_(delete_slab)(blocks_slab);
+	blocks_slab = 0;
+
+	IGD_FREE(touched_blocks);
+	touched_blocks = 0;
+	touched_count = 0;
+	touched_size = 0;
+}
+
+// Called for every translation of the superblock at addr, even the ones
+// without counters, so the discards are balanced (discard_block).
+InstrBlock* IGD_(new_block)(Addr addr) {
+	InstrBlock* block;
+
+	block = (InstrBlock*) IGD_(addr_hash_get)(blocks_pool, addr);
+	if (!block) {
+		block = (InstrBlock*) IGD_(slab_alloc)(blocks_slab);
+		block->addr = addr;
+		block->groups = 0;
+		block->last = 0;
+		block->touched = 0;
+		block->translations = 0;
+
+		IGD_(addr_hash_put)(blocks_pool, addr, block);
+	}
+
+	block->translations++;
+	block->translating = True;
+
+	return block;
+}
+
+void IGD_(block_add_group)(InstrBlock* block, InstrGroup* group) {
+	IGD_ASSERT(block != 0);
+	IGD_ASSERT(group != 0);
+
+	group->entry = block->translating;
+	block->translating = False;
+
+	group->next = 0;
+	if (block->last)
+		block->last->next = group;
+	else
+		block->groups = group;
+
+	block->last = group;
+}
+
+// Called by the instrumented code the first time the superblock is
+// executed after a snapshot.
+VG_REGPARM(1)
+void IGD_(touch_block)(InstrBlock* block) {
+	IGD_ASSERT(block->touched == 0);
+
+	if (touched_count == touched_size) {
+		touched_size *= 2;
+		touched_blocks = (InstrBlock**) IGD_REALLOC("igd.blocks.tb.1",
+							touched_blocks, (touched_size * sizeof(InstrBlock*)));
+	}
+
+	touched_blocks[touched_count++] = block;
+	block->touched = touched_count;
+}
+
+// Flush the groups of the superblocks executed since the last call.
+void IGD_(flush_touched_blocks)(void) {
+	Int i;
+	InstrBlock* block;
+	InstrGroup* group;
+
+	for (i = 0; i < touched_count; i++) {
+		block = touched_blocks[i];
+		if (!block)
+			continue;
+
+		collect_block_counts(block);
+		for (group = block->groups; group; group = group->next) {
+			IGD_(snapshot_group)(group);
+			IGD_(flush_group)(group);
+		}
+
+		block->touched = 0;
+	}
+
+	touched_count = 0;
+}
+
+static
+Bool flush_block(InstrBlock* block, void* arg) {
+	InstrGroup* group;
+
+	collect_block_counts(block);
+	for (group = block->groups; group; group = group->next) {
+		IGD_(snapshot_group)(group);
+		IGD_(flush_group)(group);
+	}
+
+	return False;
+}
+
+// Flush the groups of all superblocks still translated, to dump them.
+void IGD_(flush_all_blocks)(void) {
+	IGD_(addr_hash_forall)(blocks_pool, (Bool (*)(void*, void*)) flush_block, 0);
+}
+
+static
+Bool zero_block(InstrBlock* block, void* arg) {
+	InstrGroup* group;
+
+	for (group = block->groups; group; group = group->next) {
+		if (!IGD_(clo).separate_threads)
+			IGD_(take_counter)(group->id);
+
+		group->exec_count = 0;
+	}
+
+	return False;
+}
+
+// Drop the counts not flushed yet of all superblocks.
+void IGD_(zero_all_blocks)(void) {
+	IGD_(addr_hash_forall)(blocks_pool, (Bool (*)(void*, void*)) zero_block, 0);
+}
+
+// Valgrind discarded a translation of the superblock at addr. When it was
+// the last one, flush the groups into the instructions and recycle them.
+void IGD_(discard_block)(Addr addr) {
+	InstrBlock* block;
+
+	block = (InstrBlock*) IGD_(addr_hash_get)(blocks_pool, addr);
+	if (!block)
+		return;
+
+	IGD_ASSERT(block->translations > 0);
+	if (--block->translations > 0)
+		return;
+
+	IGD_(addr_hash_remove)(blocks_pool, addr);
+	delete_block(block);
+}
+
+void IGD_(print_blocks_stats)(void) {
+	IGD_ASSERT(blocks_slab != 0);
+
+	VG_(dmsg)("blocks: %'d live superblocks, %'lu bytes in slabs\n",
+		IGD_(slab_count)(blocks_slab), IGD_(slab_bytes)(blocks_slab));
+}
+
+// Only complete after all the superblocks are discarded.
+void IGD_(print_increments_stats)(void) {
+	VG_(dmsg)("blocks: %'llu counter increments executed\n", counter_increments);
+}
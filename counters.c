@@ -0,0 +1,175 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                   counters.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   The execution counters of the groups, incremented by the instrumented
+   code, packed in arrays indexed by the group id instead of living in
+   the groups, so the counters of the hot code share cache lines. The ids
+   are compact (groups.c), and the arrays are allocated in chunks that
+   never move, so the counters have fixed addresses for the IR.
+
+   With --counter-width=32 the counters are 32 bits, which halves their
+   footprint. When one wraps to zero the instrumented code calls
+   IGD_(spill_counter), which adds 2^32 to an overflow array of 64 bit
+   counters of the chunk, allocated on its first overflow. The counts are
+   moved to the groups when they are flushed (blocks.c).
+
+   The per thread counters (--separate-threads=yes) are kept in threads.c.
+*/
+
+#define CHUNK_BITS 12
+#define CHUNK_SIZE (1 << CHUNK_BITS) // 4k counters
+#define CHUNK_MASK (CHUNK_SIZE - 1)
+#define DEFAULT_CHUNKS 16
+
+typedef struct _CounterChunk	CounterChunk;
+struct _CounterChunk {
+	void* counters;  // UInt or ULong, by the width.
+	ULong* overflow; // The wraps of the 32 bit counters, or null.
+};
+
+static CounterChunk* chunks = 0;
+static Int chunks_count = 0;
+static Int chunks_size = 0;
+static ULong spills = 0;
+
+static
+SizeT counter_size(void) {
+	return IGD_(clo).counter_width == 32 ? sizeof(UInt) : sizeof(ULong);
+}
+
+void IGD_(init_counters)(void) {
+	IGD_ASSERT(chunks == 0);
+
+	chunks_count = 0;
+	chunks_size = DEFAULT_CHUNKS;
+	chunks = (CounterChunk*) IGD_MALLOC("igd.counters.ic.1",
+						(chunks_size * sizeof(CounterChunk)));
+	spills = 0;
+}
+
+void IGD_(destroy_counters)(void) {
+	Int i;
+
+	IGD_ASSERT(chunks != 0);
+
+	for (i = 0; i < chunks_count; i++) {
+		IGD_FREE(chunks[i].counters);
+		if (chunks[i].overflow)
+			IGD_FREE(chunks[i].overflow);
+	}
+
+	IGD_FREE(chunks);
+	chunks = 0;
+	chunks_count = 0;
+	chunks_size = 0;
+}
+
+// Make room for the counter of the group id.
+void IGD_(counters_reserve)(UInt id) {
+	CounterChunk* chunk;
+
+	while ((id >> CHUNK_BITS) >= (UInt) chunks_count) {
+		if (chunks_count == chunks_size) {
+			chunks_size *= 2;
+			chunks = (CounterChunk*) IGD_REALLOC("igd.counters.cr.1", chunks,
+								(chunks_size * sizeof(CounterChunk)));
+		}
+
+		chunk = &chunks[chunks_count++];
+		chunk->counters = IGD_MALLOC("igd.counters.cr.2", CHUNK_SIZE * counter_size());
+		VG_(memset)(chunk->counters, 0, CHUNK_SIZE * counter_size());
+		chunk->overflow = 0;
+	}
+}
+
+// The address of the counter of the group id, for the instrumented code.
+void* IGD_(counter_addr)(UInt id) {
+	IGD_ASSERT((id >> CHUNK_BITS) < (UInt) chunks_count);
+
+	return (UChar*) chunks[id >> CHUNK_BITS].counters + (id & CHUNK_MASK) * counter_size();
+}
+
+// Called by the instrumented code when the 32 bit counter wrapped.
+VG_REGPARM(1)
+void IGD_(spill_counter)(UInt id) {
+	CounterChunk* chunk;
+
+	chunk = &chunks[id >> CHUNK_BITS];
+	if (!chunk->overflow) {
+		chunk->overflow = (ULong*) IGD_MALLOC("igd.counters.sc.1", CHUNK_SIZE * sizeof(ULong));
+		VG_(memset)(chunk->overflow, 0, CHUNK_SIZE * sizeof(ULong));
+	}
+
+	chunk->overflow[id & CHUNK_MASK] += 1ULL << 32;
+	spills++;
+}
+
+// Read and clear the counter of the group id.
+ULong IGD_(take_counter)(UInt id) {
+	ULong count;
+	CounterChunk* chunk;
+	UInt slot;
+
+	IGD_ASSERT((id >> CHUNK_BITS) < (UInt) chunks_count);
+
+	chunk = &chunks[id >> CHUNK_BITS];
+	slot = id & CHUNK_MASK;
+
+	if (IGD_(clo).counter_width == 32) {
+		count = ((UInt*) chunk->counters)[slot];
+		((UInt*) chunk->counters)[slot] = 0;
+
+		if (chunk->overflow) {
+			count += chunk->overflow[slot];
+			chunk->overflow[slot] = 0;
+		}
+	} else {
+		count = ((ULong*) chunk->counters)[slot];
+		((ULong*) chunk->counters)[slot] = 0;
+	}
+
+	return count;
+}
+
+void IGD_(print_counters_stats)(void) {
+	Int i, overflows;
+
+	overflows = 0;
+	for (i = 0; i < chunks_count; i++) {
+		if (chunks[i].overflow)
+			overflows++;
+	}
+
+	VG_(dmsg)("counters: %'d chunks of %d-bit counters (%'lu bytes),"
+		" %'d overflow arrays, %'llu spills\n", chunks_count,
+		IGD_(clo).counter_width, chunks_count * CHUNK_SIZE * counter_size(),
+		overflows, spills);
+}
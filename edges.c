@@ -0,0 +1,321 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                      edges.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Control flow edges (--edges-outfile): the number of times each exit of
+   the superblocks was taken, from the instruction of the exit (a branch,
+   call, return or jump) to the destination address.
+
+   Each source instruction has a site with a few inline targets and their
+   counters. The exits to a constant address get their target when they
+   are instrumented, and the counter is incremented by the instrumented
+   code itself. The computed exits (returns, indirect jumps and calls)
+   call IGD_(count_edge) with the destination, which is searched in the
+   inline targets and then, for megamorphic sites with more targets than
+   fit inline, in a hash of the site. The sites are never released, so
+   the counters survive the retranslations of their code.
+*/
+
+#define EDGE_INLINE_TARGETS 4
+#define SITES_POOL_SIZE 16384
+#define SITES_PER_SLAB 4096
+#define TARGETS_PER_SLAB 4096
+#define MORE_TARGETS_SIZE 64
+
+struct _EdgeSite {
+	UniqueInstr* src;                   // The instruction of the exits.
+	Addr targets[EDGE_INLINE_TARGETS];  // Free while 0.
+	ULong counts[EDGE_INLINE_TARGETS];
+	AddrHash* more;                     // Other targets: Addr -> EdgeTarget*.
+};
+
+typedef struct _EdgeTarget	EdgeTarget;
+struct _EdgeTarget {
+	Addr dst;
+	ULong count;
+};
+
+static AddrHash* edge_sites = 0; // UniqueInstr* -> EdgeSite*
+static Slab* sites_slab = 0;
+static Slab* targets_slab = 0;
+static Int megamorphic_sites = 0;
+
+void IGD_(init_edges)(void) {
+	IGD_ASSERT(edge_sites == 0);
+
+	edge_sites = IGD_(new_addr_hash)(SITES_POOL_SIZE);
+	sites_slab = IGD_(new_slab)("igd.edges.ie.1", sizeof(EdgeSite), SITES_PER_SLAB);
+	targets_slab = IGD_(new_slab)("igd.edges.ie.2", sizeof(EdgeTarget), TARGETS_PER_SLAB);
+	megamorphic_sites = 0;
+}
+
+static
+void delete_site(EdgeSite* site) {
+	// The targets are released with their slab.
+	if (site->more) {
+		IGD_(addr_hash_clear)(site->more, 0);
+		IGD_(delete_addr_hash)(site->more);
+	}
+}
+
+void IGD_(destroy_edges)(void) {
+	IGD_ASSERT(edge_sites != 0);
+
+	IGD_(addr_hash_clear)(edge_sites, (void (*)(void*)) delete_site);
+	IGD_(delete_addr_hash)(edge_sites);
+	edge_sites = 0;
+
+	IGD_(delete_slab)(sites_slab);
+	sites_slab = 0;
+
+	IGD_(delete_slab)(targets_slab);
+	targets_slab = 0;
+}
+
+// The site of the exits of the instruction, created on the first use.
+EdgeSite* IGD_(edge_site)(UniqueInstr* src) {
+	EdgeSite* site;
+
+	IGD_ASSERT(src != 0);
+
+	site = (EdgeSite*) IGD_(addr_hash_get)(edge_sites, (Addr) src);
+	if (!site) {
+		site = (EdgeSite*) IGD_(slab_alloc)(sites_slab);
+		VG_(memset)(site, 0, sizeof(EdgeSite));
+		site->src = src;
+
+		IGD_(addr_hash_put)(edge_sites, (Addr) src, site);
+	}
+
+	return site;
+}
+
+static
+ULong* more_counter(EdgeSite* site, Addr dst) {
+	EdgeTarget* target;
+
+	if (!site->more) {
+		site->more = IGD_(new_addr_hash)(MORE_TARGETS_SIZE);
+		megamorphic_sites++;
+	}
+
+	target = (EdgeTarget*) IGD_(addr_hash_get)(site->more, dst);
+	if (!target) {
+		target = (EdgeTarget*) IGD_(slab_alloc)(targets_slab);
+		target->dst = dst;
+		target->count = 0;
+
+		IGD_(addr_hash_put)(site->more, dst, target);
+	}
+
+	return &(target->count);
+}
+
+// The counter of the edge, taking a free inline target if it is new. The
+// address of the counter does not change.
+ULong* IGD_(edge_counter)(EdgeSite* site, Addr dst) {
+	Int i;
+
+	IGD_ASSERT(site != 0);
+
+	for (i = 0; i < EDGE_INLINE_TARGETS; i++) {
+		if (site->targets[i] == dst)
+			return &(site->counts[i]);
+
+		if (site->targets[i] == 0) {
+			site->targets[i] = dst;
+			return &(site->counts[i]);
+		}
+	}
+
+	return more_counter(site, dst);
+}
+
+// Called by the computed exits.
+VG_REGPARM(2)
+void IGD_(count_edge)(EdgeSite* site, Addr dst) {
+	++(*IGD_(edge_counter)(site, dst));
+}
+
+static
+Bool zero_target(EdgeTarget* target, void* arg) {
+	target->count = 0;
+	return False;
+}
+
+static
+Bool zero_site(EdgeSite* site, void* arg) {
+	Int i;
+
+	for (i = 0; i < EDGE_INLINE_TARGETS; i++)
+		site->counts[i] = 0;
+
+	if (site->more)
+		IGD_(addr_hash_forall)(site->more, (Bool (*)(void*, void*)) zero_target, 0);
+
+	return False;
+}
+
+void IGD_(zero_edges)(void) {
+	IGD_(addr_hash_forall)(edge_sites, (Bool (*)(void*, void*)) zero_site, 0);
+}
+
+static
+Bool scale_target(EdgeTarget* target, void* arg) {
+	target->count = IGD_(sampled_count)(target->count);
+	return False;
+}
+
+static
+Bool scale_site(EdgeSite* site, void* arg) {
+	Int i;
+
+	for (i = 0; i < EDGE_INLINE_TARGETS; i++)
+		site->counts[i] = IGD_(sampled_count)(site->counts[i]);
+
+	if (site->more)
+		IGD_(addr_hash_forall)(site->more, (Bool (*)(void*, void*)) scale_target, 0);
+
+	return False;
+}
+
+// Scale the edge counts of a sampled run (sampling.c).
+void IGD_(scale_edges)(void) {
+	IGD_(addr_hash_forall)(edge_sites, (Bool (*)(void*, void*)) scale_site, 0);
+}
+
+static
+Bool collect_site(EdgeSite* site, EdgeSite*** next) {
+	*((*next)++) = site;
+	return False;
+}
+
+static
+Bool collect_target(EdgeTarget* target, EdgeTarget*** next) {
+	*((*next)++) = target;
+	return False;
+}
+
+static
+Int cmp_sites(const void* p1, const void* p2) {
+	const EdgeSite* s1 = *((const EdgeSite* const*) p1);
+	const EdgeSite* s2 = *((const EdgeSite* const*) p2);
+
+	return IGD_(cmp_instrs_addr)(&s1->src, &s2->src);
+}
+
+static
+Int cmp_targets(const void* p1, const void* p2) {
+	const EdgeTarget* t1 = *((const EdgeTarget* const*) p1);
+	const EdgeTarget* t2 = *((const EdgeTarget* const*) p2);
+
+	return t1->dst < t2->dst ? -1 : (t1->dst > t2->dst ? 1 : 0);
+}
+
+static
+void write_edge(FileWriter* fw, UniqueInstr* src, Addr dst, ULong count) {
+	if (count == 0)
+		return;
+
+	IGD_(file_writer_bytes)(fw, "0x", 2);
+	IGD_(file_writer_hex)(fw, src->addr);
+	IGD_(file_writer_bytes)(fw, ":0x", 3);
+	IGD_(file_writer_hex)(fw, dst);
+	IGD_(file_writer_char)(fw, ':');
+	IGD_(file_writer_dec)(fw, count);
+	if (src->gen != 0) {
+		IGD_(file_writer_char)(fw, ':');
+		IGD_(file_writer_dec)(fw, src->gen);
+	}
+	IGD_(file_writer_char)(fw, '\n');
+}
+
+// Write the taken edges, "0xsrc:0xdst:count[:gen]" lines sorted by the
+// source and then the destination address. The generation is the one of
+// the source instruction.
+void IGD_(dump_edges)(const HChar* filename) {
+	Int i, j, k, count, nmore;
+	EdgeSite** sites;
+	EdgeSite** next;
+	EdgeTarget* inline_targets[EDGE_INLINE_TARGETS];
+	EdgeTarget** targets;
+	EdgeTarget** tnext;
+	EdgeTarget copies[EDGE_INLINE_TARGETS];
+	FileWriter* fw;
+
+	count = IGD_(addr_hash_count)(edge_sites);
+	sites = (EdgeSite**) IGD_MALLOC("igd.edges.de.1", ((count + 1) * sizeof(EdgeSite*)));
+
+	next = sites;
+	IGD_(addr_hash_forall)(edge_sites, (Bool (*)(void*, void*)) collect_site, &next);
+	IGD_ASSERT((next - sites) == count);
+
+	VG_(ssort)(sites, count, sizeof(EdgeSite*), cmp_sites);
+
+	fw = IGD_(new_file_writer)(filename);
+	for (i = 0; i < count; i++) {
+		EdgeSite* site = sites[i];
+
+		// The inline targets and the megamorphic ones, sorted together.
+		nmore = site->more ? IGD_(addr_hash_count)(site->more) : 0;
+		targets = nmore > 0 ? (EdgeTarget**) IGD_MALLOC("igd.edges.de.2",
+					((nmore + EDGE_INLINE_TARGETS) * sizeof(EdgeTarget*))) : inline_targets;
+
+		k = 0;
+		for (j = 0; j < EDGE_INLINE_TARGETS && site->targets[j] != 0; j++) {
+			copies[j].dst = site->targets[j];
+			copies[j].count = site->counts[j];
+			targets[k++] = &copies[j];
+		}
+
+		if (nmore > 0) {
+			tnext = targets + k;
+			IGD_(addr_hash_forall)(site->more, (Bool (*)(void*, void*)) collect_target, &tnext);
+			k += nmore;
+		}
+
+		VG_(ssort)(targets, k, sizeof(EdgeTarget*), cmp_targets);
+
+		for (j = 0; j < k; j++)
+			write_edge(fw, site->src, targets[j]->dst, targets[j]->count);
+
+		if (targets != inline_targets)
+			IGD_FREE(targets);
+	}
+	IGD_(delete_file_writer)(fw);
+
+	IGD_FREE(sites);
+}
+
+void IGD_(print_edges_stats)(void) {
+	VG_(dmsg)("edges: %'d sites (%'d megamorphic, with more than %d targets),"
+		" %'d extra targets\n", IGD_(addr_hash_count)(edge_sites),
+		megamorphic_sites, EDGE_INLINE_TARGETS, IGD_(slab_count)(targets_slab));
+}
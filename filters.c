@@ -0,0 +1,221 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                    filters.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Filters of the code to count: --include-objs and --exclude-objs take
+   comma separated patterns (with '*' and '?') matched against the file
+   names of the objects, full or base name, and --include-range takes
+   comma separated "start-end" hexadecimal address ranges. The filtered
+   superblocks are decided by their entry address when translated, and
+   are left as they are, so they run without any counter.
+
+   The decision of each object is cached by its DebugInfo handle, since
+   many superblocks come from the same objects.
+*/
+
+#define MAX_PATTERNS 64
+#define MAX_RANGES 64
+#define CHECKED_OBJS_SIZE 256
+
+#define OBJ_INCLUDED ((void*) 1)
+#define OBJ_EXCLUDED ((void*) 2)
+
+typedef struct _AddrRange	AddrRange;
+struct _AddrRange {
+	Addr start;
+	Addr end; // Exclusive.
+};
+
+static HChar* include_patterns[MAX_PATTERNS];
+static Int include_count = 0;
+static HChar* exclude_patterns[MAX_PATTERNS];
+static Int exclude_count = 0;
+static AddrRange include_ranges[MAX_RANGES];
+static Int ranges_count = 0;
+
+static AddrHash* checked_objs = 0; // DebugInfo handle -> OBJ_INCLUDED/EXCLUDED
+static ULong filtered_blocks = 0;
+
+static
+Int split_patterns(const HChar* option, const HChar* value, HChar** patterns) {
+	Int count;
+	HChar* copy;
+	HChar* token;
+	HChar* save;
+
+	count = 0;
+	copy = VG_(strdup)("igd.filters.sp.1", value);
+	for (token = VG_(strtok_r)(copy, ",", &save); token;
+			token = VG_(strtok_r)(0, ",", &save)) {
+		if (count == MAX_PATTERNS)
+			VG_(fmsg_bad_option)(option, "At most %d patterns are allowed\n", MAX_PATTERNS);
+
+		patterns[count++] = VG_(strdup)("igd.filters.sp.2", token);
+	}
+	IGD_FREE(copy);
+
+	return count;
+}
+
+static
+void parse_ranges(const HChar* value) {
+	HChar* copy;
+	HChar* token;
+	HChar* save;
+	HChar* start;
+	HChar* end;
+	AddrRange* range;
+
+	copy = VG_(strdup)("igd.filters.pr.1", value);
+	for (token = VG_(strtok_r)(copy, ",", &save); token;
+			token = VG_(strtok_r)(0, ",", &save)) {
+		if (ranges_count == MAX_RANGES)
+			VG_(fmsg_bad_option)("--include-range", "At most %d ranges are allowed\n", MAX_RANGES);
+
+		range = &include_ranges[ranges_count++];
+		range->start = (Addr) VG_(strtoull16)(token, &end);
+		if (end == token || *end != '-')
+			VG_(fmsg_bad_option)("--include-range", "Invalid range '%s'\n", token);
+
+		start = end + 1;
+		range->end = (Addr) VG_(strtoull16)(start, &end);
+		if (end == start || *end != '\0' || range->end <= range->start)
+			VG_(fmsg_bad_option)("--include-range", "Invalid range '%s'\n", token);
+	}
+	IGD_FREE(copy);
+}
+
+void IGD_(init_filters)(void) {
+	IGD_ASSERT(checked_objs == 0);
+
+	include_count = exclude_count = ranges_count = 0;
+	if (IGD_(clo).include_objs)
+		include_count = split_patterns("--include-objs", IGD_(clo).include_objs, include_patterns);
+	if (IGD_(clo).exclude_objs)
+		exclude_count = split_patterns("--exclude-objs", IGD_(clo).exclude_objs, exclude_patterns);
+	if (IGD_(clo).include_range)
+		parse_ranges(IGD_(clo).include_range);
+
+	checked_objs = IGD_(new_addr_hash)(CHECKED_OBJS_SIZE);
+	filtered_blocks = 0;
+}
+
+void IGD_(destroy_filters)(void) {
+	Int i;
+
+	IGD_ASSERT(checked_objs != 0);
+
+	for (i = 0; i < include_count; i++)
+		IGD_FREE(include_patterns[i]);
+	for (i = 0; i < exclude_count; i++)
+		IGD_FREE(exclude_patterns[i]);
+	include_count = exclude_count = ranges_count = 0;
+
+	IGD_(addr_hash_clear)(checked_objs, 0);
+	IGD_(delete_addr_hash)(checked_objs);
+	checked_objs = 0;
+}
+
+Bool IGD_(filters_enabled)(void) {
+	return IGD_(clo).include_objs || IGD_(clo).exclude_objs || IGD_(clo).include_range;
+}
+
+static
+Bool match_patterns(HChar** patterns, Int count, const HChar* filename) {
+	Int i;
+	const HChar* basename;
+
+	basename = VG_(strrchr)(filename, '/');
+	basename = basename ? basename + 1 : filename;
+
+	for (i = 0; i < count; i++) {
+		if (VG_(string_match)(patterns[i], filename) ||
+				VG_(string_match)(patterns[i], basename))
+			return True;
+	}
+
+	return False;
+}
+
+static
+Bool check_obj(const HChar* filename) {
+	if (include_count > 0 && !match_patterns(include_patterns, include_count, filename))
+		return False;
+
+	return !match_patterns(exclude_patterns, exclude_count, filename);
+}
+
+// Whether the superblock at the address is counted.
+Bool IGD_(filter_block)(Addr addr) {
+	Int i;
+	Bool counted;
+	Addr handle;
+	const DebugInfo* di;
+	void* decision;
+
+	counted = True;
+	if (ranges_count > 0) {
+		counted = False;
+		for (i = 0; i < ranges_count; i++) {
+			if (addr >= include_ranges[i].start && addr < include_ranges[i].end) {
+				counted = True;
+				break;
+			}
+		}
+	}
+
+	if (counted && (include_count > 0 || exclude_count > 0)) {
+		di = VG_(find_DebugInfo)(VG_(current_DiEpoch)(), addr);
+		if (di) {
+			handle = (Addr) VG_(DebugInfo_get_handle)(di);
+
+			decision = IGD_(addr_hash_get)(checked_objs, handle);
+			if (!decision) {
+				decision = check_obj(VG_(DebugInfo_get_filename)(di)) ?
+								OBJ_INCLUDED : OBJ_EXCLUDED;
+				IGD_(addr_hash_put)(checked_objs, handle, decision);
+			}
+
+			counted = decision == OBJ_INCLUDED;
+		} else {
+			// Code outside of the objects (generated at run time).
+			counted = include_count == 0;
+		}
+	}
+
+	if (!counted)
+		filtered_blocks++;
+
+	return counted;
+}
+
+void IGD_(print_filters_stats)(void) {
+	VG_(dmsg)("filters: %'llu superblocks translated without counters\n", filtered_blocks);
+}
@@ -0,0 +1,716 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                     format.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Binary instructions file layout (all integers are unsigned LEB128,
+   unless stated otherwise):
+
+     magic       4 bytes: 'I' 'G' 'D' 'B'
+     version     currently 2
+     word size   sizeof(Addr) of the profiled guest
+     nmodules    number of entries in the module table
+     modules     nmodules times: name length, name bytes, base, size
+     nrecords    number of instruction records
+     records     nrecords times: address delta, size, [generation,]
+                 execution count
+
+   Records are sorted by ascending address and each address is stored
+   as the difference to the previous record (the first one to zero).
+   The size is stored shifted left by one bit, and if the low bit is set
+   the code generation follows the size.
+*/
+
+#define WRITER_BUFFER_SIZE 262144 // 256k bytes
+#define READER_BUFFER_SIZE 262144 // 256k bytes
+
+struct _FileWriter {
+	Int fd;
+	Bool owned;    // The fd was opened by the writer, and is closed with it.
+	Int used;
+	ULong flushed; // Bytes already written to the file.
+	UChar* buffer;
+};
+
+struct _FileReader {
+	Int fd;
+	Int pos;
+	Int used;
+	Bool eof;
+	UChar* buffer;
+};
+
+static
+void flush_file_writer(FileWriter* fw) {
+	Int done, s;
+
+	IGD_ASSERT(fw != 0);
+
+	done = 0;
+	while (done < fw->used) {
+		s = VG_(write)(fw->fd, fw->buffer + done, fw->used - done);
+		IGD_ASSERT(s > 0);
+
+		done += s;
+	}
+
+	fw->flushed += fw->used;
+	fw->used = 0;
+}
+
+FileWriter* IGD_(new_file_writer)(const HChar* filename) {
+	Int fd;
+	FileWriter* fw;
+
+	IGD_ASSERT(filename != 0);
+
+	fd = VG_(fd_open)(filename, VKI_O_CREAT|VKI_O_WRONLY|VKI_O_TRUNC,
+						VKI_S_IRUSR|VKI_S_IWUSR);
+	IGD_ASSERT(fd >= 0);
+
+	fw = IGD_(new_fd_file_writer)(fd);
+	fw->owned = True;
+
+	return fw;
+}
+
+// Write to a file already open, such as the standard output, which is
+// left open when the writer is deleted.
+FileWriter* IGD_(new_fd_file_writer)(Int fd) {
+	FileWriter* fw;
+
+	IGD_ASSERT(fd >= 0);
+
+	fw = (FileWriter*) IGD_MALLOC("igd.format.nfw.1", sizeof(FileWriter));
+	fw->fd = fd;
+	fw->owned = False;
+	fw->used = 0;
+	fw->flushed = 0;
+	fw->buffer = (UChar*) IGD_MALLOC("igd.format.nfw.2", WRITER_BUFFER_SIZE);
+
+	return fw;
+}
+
+void IGD_(delete_file_writer)(FileWriter* fw) {
+	IGD_ASSERT(fw != 0);
+
+	flush_file_writer(fw);
+	if (fw->owned)
+		VG_(close)(fw->fd);
+
+	IGD_FREE(fw->buffer);
+	IGD_DATA_FREE(fw, sizeof(FileWriter));
+}
+
+void IGD_(file_writer_bytes)(FileWriter* fw, const void* data, Int size) {
+	const UChar* ptr;
+
+	IGD_ASSERT(fw != 0);
+	IGD_ASSERT(size >= 0);
+
+	ptr = (const UChar*) data;
+	while (size > 0) {
+		Int chunk;
+
+		if (fw->used == WRITER_BUFFER_SIZE)
+			flush_file_writer(fw);
+
+		chunk = WRITER_BUFFER_SIZE - fw->used;
+		if (chunk > size)
+			chunk = size;
+
+		VG_(memcpy)(fw->buffer + fw->used, ptr, chunk);
+		fw->used += chunk;
+
+		ptr += chunk;
+		size -= chunk;
+	}
+}
+
+// The offset in the file of the next byte written.
+ULong IGD_(file_writer_offset)(FileWriter* fw) {
+	IGD_ASSERT(fw != 0);
+	return fw->flushed + fw->used;
+}
+
+void IGD_(file_writer_char)(FileWriter* fw, HChar c) {
+	IGD_ASSERT(fw != 0);
+
+	if (fw->used == WRITER_BUFFER_SIZE)
+		flush_file_writer(fw);
+
+	fw->buffer[fw->used++] = (UChar) c;
+}
+
+void IGD_(file_writer_uleb)(FileWriter* fw, ULong value) {
+	IGD_ASSERT(fw != 0);
+
+	// An ULong takes at most 10 bytes.
+	if ((fw->used + 10) > WRITER_BUFFER_SIZE)
+		flush_file_writer(fw);
+
+	do {
+		UChar byte = value & 0x7f;
+
+		value >>= 7;
+		if (value != 0)
+			byte |= 0x80;
+
+		fw->buffer[fw->used++] = byte;
+	} while (value != 0);
+}
+
+void IGD_(file_writer_hex)(FileWriter* fw, ULong value) {
+	Int idx;
+	HChar tmp[16];
+
+	IGD_ASSERT(fw != 0);
+
+	idx = sizeof(tmp);
+	do {
+		tmp[--idx] = "0123456789abcdef"[value & 0xf];
+		value >>= 4;
+	} while (value != 0);
+
+	IGD_(file_writer_bytes)(fw, tmp + idx, sizeof(tmp) - idx);
+}
+
+void IGD_(file_writer_dec)(FileWriter* fw, ULong value) {
+	Int idx;
+	HChar tmp[20];
+
+	IGD_ASSERT(fw != 0);
+
+	idx = sizeof(tmp);
+	do {
+		tmp[--idx] = '0' + (value % 10);
+		value /= 10;
+	} while (value != 0);
+
+	IGD_(file_writer_bytes)(fw, tmp + idx, sizeof(tmp) - idx);
+}
+
+static
+Bool fill_file_reader(FileReader* fr) {
+	Int s;
+
+	IGD_ASSERT(fr != 0);
+
+	if (fr->eof)
+		return False;
+
+	// Move the remaining bytes to the beginning of the buffer.
+	if (fr->pos > 0) {
+		VG_(memmove)(fr->buffer, fr->buffer + fr->pos, fr->used - fr->pos);
+		fr->used -= fr->pos;
+		fr->pos = 0;
+	}
+
+	if (fr->used == READER_BUFFER_SIZE)
+		return True;
+
+	s = VG_(read)(fr->fd, fr->buffer + fr->used, READER_BUFFER_SIZE - fr->used);
+	if (s <= 0) {
+		fr->eof = True;
+		return False;
+	}
+
+	fr->used += s;
+	return True;
+}
+
+FileReader* IGD_(new_file_reader)(Int fd) {
+	FileReader* fr;
+
+	IGD_ASSERT(fd >= 0);
+
+	fr = (FileReader*) IGD_MALLOC("igd.format.nfr.1", sizeof(FileReader));
+	fr->fd = fd;
+	fr->pos = 0;
+	fr->used = 0;
+	fr->eof = False;
+	fr->buffer = (UChar*) IGD_MALLOC("igd.format.nfr.2", READER_BUFFER_SIZE);
+
+	return fr;
+}
+
+// The file descriptor is not closed, it belongs to the caller.
+void IGD_(delete_file_reader)(FileReader* fr) {
+	IGD_ASSERT(fr != 0);
+
+	IGD_FREE(fr->buffer);
+	IGD_DATA_FREE(fr, sizeof(FileReader));
+}
+
+Int IGD_(file_reader_peek)(FileReader* fr, void* data, Int size) {
+	IGD_ASSERT(fr != 0);
+	IGD_ASSERT(size >= 0 && size <= READER_BUFFER_SIZE);
+
+	while ((fr->used - fr->pos) < size) {
+		if (!fill_file_reader(fr))
+			break;
+	}
+
+	if (size > (fr->used - fr->pos))
+		size = fr->used - fr->pos;
+
+	VG_(memcpy)(data, fr->buffer + fr->pos, size);
+	return size;
+}
+
+Bool IGD_(file_reader_bytes)(FileReader* fr, void* data, Int size) {
+	UChar* ptr;
+
+	IGD_ASSERT(fr != 0);
+	IGD_ASSERT(size >= 0);
+
+	ptr = (UChar*) data;
+	while (size > 0) {
+		Int chunk;
+
+		if (fr->pos == fr->used && !fill_file_reader(fr))
+			return False;
+
+		chunk = fr->used - fr->pos;
+		if (chunk > size)
+			chunk = size;
+
+		VG_(memcpy)(ptr, fr->buffer + fr->pos, chunk);
+		fr->pos += chunk;
+
+		ptr += chunk;
+		size -= chunk;
+	}
+
+	return True;
+}
+
+Bool IGD_(file_reader_uleb)(FileReader* fr, ULong* value) {
+	Int shift;
+	UChar byte;
+
+	IGD_ASSERT(fr != 0);
+	IGD_ASSERT(value != 0);
+
+	*value = 0;
+	shift = 0;
+	do {
+		if (fr->pos == fr->used && !fill_file_reader(fr))
+			return False;
+
+		IGD_ASSERT(shift < 64);
+		byte = fr->buffer[fr->pos++];
+
+		*value |= ((ULong) (byte & 0x7f)) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return True;
+}
+
+static __inline__
+Int peek_char(FileReader* fr) {
+	if (fr->pos == fr->used && !fill_file_reader(fr))
+		return -1;
+
+	return fr->buffer[fr->pos];
+}
+
+// Skip blanks, line breaks and comments up to the next token.
+static
+Int skip_blanks(FileReader* fr) {
+	Int c;
+
+	while ((c = peek_char(fr)) != -1) {
+		if (c == '#') {
+			while ((c = peek_char(fr)) != -1 && c != '\n')
+				fr->pos++;
+		} else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			fr->pos++;
+		} else {
+			break;
+		}
+	}
+
+	return c;
+}
+
+static
+ULong scan_hex(FileReader* fr) {
+	Int c, digits;
+	ULong value;
+
+	value = 0;
+	digits = 0;
+	while ((c = peek_char(fr)) != -1) {
+		if (c >= '0' && c <= '9')
+			value = (value << 4) | (c - '0');
+		else if (c >= 'a' && c <= 'f')
+			value = (value << 4) | (c - 'a' + 10);
+		else if (c >= 'A' && c <= 'F')
+			value = (value << 4) | (c - 'A' + 10);
+		else
+			break;
+
+		fr->pos++;
+		digits++;
+	}
+
+	if (digits == 0)
+		VG_(tool_panic)("instrgrind: invalid address in instructions file");
+
+	return value;
+}
+
+static
+ULong scan_dec(FileReader* fr) {
+	Int c;
+	ULong value;
+
+	c = skip_blanks(fr);
+	if (c < '0' || c > '9')
+		VG_(tool_panic)("instrgrind: invalid number in instructions file");
+
+	value = 0;
+	while ((c = peek_char(fr)) >= '0' && c <= '9') {
+		value = (value * 10) + (c - '0');
+		fr->pos++;
+	}
+
+	return value;
+}
+
+static
+void scan_colon(FileReader* fr) {
+	if (skip_blanks(fr) != ':')
+		VG_(tool_panic)("instrgrind: expected ':' in instructions file");
+
+	fr->pos++;
+}
+
+// Read a "@id:0xsize:name" module line, if it is the next one. The
+// name goes up to the end of the line.
+Bool IGD_(read_text_module)(FileReader* fr, Int* id, SizeT* size, HChar** name) {
+	Int c, len, max;
+	HChar* str;
+
+	IGD_ASSERT(fr != 0);
+	IGD_ASSERT(id != 0 && size != 0 && name != 0);
+
+	if (skip_blanks(fr) != '@')
+		return False;
+	fr->pos++;
+
+	*id = (Int) scan_dec(fr);
+
+	scan_colon(fr);
+	if (skip_blanks(fr) != '0')
+		VG_(tool_panic)("instrgrind: invalid module in instructions file");
+	fr->pos++;
+
+	c = peek_char(fr);
+	if (c != 'x' && c != 'X')
+		VG_(tool_panic)("instrgrind: invalid module in instructions file");
+	fr->pos++;
+
+	*size = (SizeT) scan_hex(fr);
+
+	scan_colon(fr);
+
+	len = 0;
+	max = 256;
+	str = (HChar*) IGD_MALLOC("igd.format.rtm.1", max);
+	while ((c = peek_char(fr)) != -1 && c != '\n' && c != '\r') {
+		if ((len + 1) == max) {
+			max *= 2;
+			str = (HChar*) IGD_REALLOC("igd.format.rtm.2", str, max);
+		}
+
+		str[len++] = (HChar) c;
+		fr->pos++;
+	}
+	str[len] = '\0';
+
+	*name = str;
+
+	return True;
+}
+
+void IGD_(write_text_module)(FileWriter* fw, Int id, SizeT size, const HChar* name) {
+	IGD_ASSERT(fw != 0);
+	IGD_ASSERT(name != 0);
+
+	IGD_(file_writer_char)(fw, '@');
+	IGD_(file_writer_dec)(fw, id);
+	IGD_(file_writer_bytes)(fw, ":0x", 3);
+	IGD_(file_writer_hex)(fw, size);
+	IGD_(file_writer_char)(fw, ':');
+	IGD_(file_writer_bytes)(fw, name, VG_(strlen)(name));
+	IGD_(file_writer_char)(fw, '\n');
+}
+
+// Read the next "0xaddr:size:count[:gen]" text record, or the module
+// relative "id+0xoffset:size:count[:gen]" one, scanning the buffer in
+// place. The module is -1 for absolute addresses. Return False on the
+// end of the file.
+Bool IGD_(read_text_record)(FileReader* fr, Int* module, Addr* addr, Int* size, UInt* gen, ULong* count) {
+	Int c;
+
+	IGD_ASSERT(fr != 0);
+	IGD_ASSERT(module != 0 && addr != 0 && size != 0 && gen != 0 && count != 0);
+
+	c = skip_blanks(fr);
+	if (c == -1)
+		return False;
+
+	if (c < '0' || c > '9')
+		VG_(tool_panic)("instrgrind: invalid address in instructions file");
+
+	if (c == '0') {
+		fr->pos++;
+		c = peek_char(fr);
+	}
+
+	*module = -1;
+	if (c != 'x' && c != 'X') {
+		ULong id;
+
+		// A module id, its leading 0 may be already consumed.
+		id = 0;
+		while ((c = peek_char(fr)) >= '0' && c <= '9') {
+			id = (id * 10) + (c - '0');
+			fr->pos++;
+		}
+
+		if (c != '+')
+			VG_(tool_panic)("instrgrind: invalid address in instructions file");
+		fr->pos++;
+
+		*module = (Int) id;
+
+		if (peek_char(fr) != '0')
+			VG_(tool_panic)("instrgrind: invalid address in instructions file");
+		fr->pos++;
+
+		c = peek_char(fr);
+		if (c != 'x' && c != 'X')
+			VG_(tool_panic)("instrgrind: invalid address in instructions file");
+	}
+	fr->pos++;
+
+	*addr = (Addr) scan_hex(fr);
+
+	scan_colon(fr);
+	*size = (Int) scan_dec(fr);
+
+	scan_colon(fr);
+	*count = scan_dec(fr);
+
+	// The generation is only present for reused addresses.
+	*gen = 0;
+	if (skip_blanks(fr) == ':') {
+		scan_colon(fr);
+		*gen = (UInt) scan_dec(fr);
+	}
+
+	return True;
+}
+
+Bool IGD_(is_binary_file)(FileReader* fr) {
+	HChar magic[4];
+
+	return IGD_(file_reader_peek)(fr, magic, sizeof(magic)) == sizeof(magic) &&
+			VG_(memcmp)(magic, IGD_BINARY_MAGIC, sizeof(magic)) == 0;
+}
+
+void IGD_(write_binary_header)(FileWriter* fw, Int nmodules) {
+	IGD_ASSERT(fw != 0);
+	IGD_ASSERT(nmodules >= 0);
+
+	IGD_(file_writer_bytes)(fw, IGD_BINARY_MAGIC, 4);
+	IGD_(file_writer_uleb)(fw, IGD_BINARY_VERSION);
+	IGD_(file_writer_uleb)(fw, sizeof(Addr));
+	IGD_(file_writer_uleb)(fw, nmodules);
+}
+
+Int IGD_(read_binary_header)(FileReader* fr) {
+	HChar magic[4];
+	ULong version, wsize, nmodules;
+
+	IGD_ASSERT(fr != 0);
+
+	if (!IGD_(file_reader_bytes)(fr, magic, sizeof(magic)) ||
+			VG_(memcmp)(magic, IGD_BINARY_MAGIC, sizeof(magic)) != 0)
+		VG_(tool_panic)("instrgrind: invalid binary instructions file");
+
+	if (!IGD_(file_reader_uleb)(fr, &version) || version != IGD_BINARY_VERSION)
+		VG_(tool_panic)("instrgrind: unsupported binary instructions file version");
+
+	if (!IGD_(file_reader_uleb)(fr, &wsize) || wsize != sizeof(Addr))
+		VG_(tool_panic)("instrgrind: binary instructions file word size mismatch");
+
+	if (!IGD_(file_reader_uleb)(fr, &nmodules))
+		VG_(tool_panic)("instrgrind: truncated binary instructions file");
+
+	return (Int) nmodules;
+}
+
+void IGD_(write_binary_module)(FileWriter* fw, const HChar* name, Addr base, SizeT size) {
+	Int len;
+
+	IGD_ASSERT(fw != 0);
+	IGD_ASSERT(name != 0);
+
+	len = VG_(strlen)(name);
+	IGD_(file_writer_uleb)(fw, len);
+	IGD_(file_writer_bytes)(fw, name, len);
+	IGD_(file_writer_uleb)(fw, base);
+	IGD_(file_writer_uleb)(fw, size);
+}
+
+// The module name is allocated and must be freed by the caller.
+void IGD_(read_binary_module)(FileReader* fr, HChar** name, Addr* base, SizeT* size) {
+	ULong len, tmp;
+
+	IGD_ASSERT(fr != 0);
+	IGD_ASSERT(name != 0 && base != 0 && size != 0);
+
+	if (!IGD_(file_reader_uleb)(fr, &len))
+		VG_(tool_panic)("instrgrind: truncated binary instructions file");
+
+	*name = (HChar*) IGD_MALLOC("igd.format.rbm.1", len + 1);
+	if (!IGD_(file_reader_bytes)(fr, *name, len))
+		VG_(tool_panic)("instrgrind: truncated binary instructions file");
+	(*name)[len] = 0;
+
+	if (!IGD_(file_reader_uleb)(fr, &tmp))
+		VG_(tool_panic)("instrgrind: truncated binary instructions file");
+	*base = (Addr) tmp;
+
+	if (!IGD_(file_reader_uleb)(fr, &tmp))
+		VG_(tool_panic)("instrgrind: truncated binary instructions file");
+	*size = (SizeT) tmp;
+}
+
+void IGD_(write_binary_count)(FileWriter* fw, ULong nrecords) {
+	IGD_ASSERT(fw != 0);
+	IGD_(file_writer_uleb)(fw, nrecords);
+}
+
+// Encode the count padded to IGD_BINARY_COUNT_WIDTH bytes (with empty
+// continuation bytes), so it can be patched in place when the number of
+// records is only known after they are written.
+void IGD_(encode_binary_count)(UChar* buffer, ULong nrecords) {
+	Int i;
+
+	IGD_ASSERT(buffer != 0);
+
+	for (i = 0; i < IGD_BINARY_COUNT_WIDTH; i++) {
+		buffer[i] = nrecords & 0x7f;
+		if (i < (IGD_BINARY_COUNT_WIDTH - 1))
+			buffer[i] |= 0x80;
+
+		nrecords >>= 7;
+	}
+}
+
+ULong IGD_(read_binary_count)(FileReader* fr) {
+	ULong nrecords;
+
+	IGD_ASSERT(fr != 0);
+
+	if (!IGD_(file_reader_uleb)(fr, &nrecords))
+		VG_(tool_panic)("instrgrind: truncated binary instructions file");
+
+	return nrecords;
+}
+
+// Records must be written in ascending address order.
+void IGD_(write_binary_record)(FileWriter* fw, Addr* last, Addr addr, Int size, UInt gen, ULong count) {
+	IGD_ASSERT(fw != 0);
+	IGD_ASSERT(last != 0);
+	IGD_ASSERT(addr >= *last);
+	IGD_ASSERT(size >= 0);
+
+	IGD_(file_writer_uleb)(fw, addr - *last);
+	IGD_(file_writer_uleb)(fw, (((ULong) size) << 1) | (gen != 0 ? 1 : 0));
+	if (gen != 0)
+		IGD_(file_writer_uleb)(fw, gen);
+	IGD_(file_writer_uleb)(fw, count);
+
+	*last = addr;
+}
+
+void IGD_(read_binary_record)(FileReader* fr, Addr* last, Addr* addr, Int* size, UInt* gen, ULong* count) {
+	ULong delta, tmp, tmp2;
+
+	IGD_ASSERT(fr != 0);
+	IGD_ASSERT(last != 0);
+	IGD_ASSERT(addr != 0 && size != 0 && gen != 0 && count != 0);
+
+	if (!IGD_(file_reader_uleb)(fr, &delta) ||
+			!IGD_(file_reader_uleb)(fr, &tmp))
+		VG_(tool_panic)("instrgrind: truncated binary instructions file");
+
+	tmp2 = 0;
+	if ((tmp & 1) && !IGD_(file_reader_uleb)(fr, &tmp2))
+		VG_(tool_panic)("instrgrind: truncated binary instructions file");
+	tmp >>= 1;
+
+	if (!IGD_(file_reader_uleb)(fr, count))
+		VG_(tool_panic)("instrgrind: truncated binary instructions file");
+
+	*addr = *last + (Addr) delta;
+	*size = (Int) tmp;
+	*gen = (UInt) tmp2;
+
+	*last = *addr;
+}
+
+// With a module (not -1) the address is an offset in its text.
+void IGD_(write_text_record)(FileWriter* fw, Int module, Addr addr, Int size, UInt gen, ULong count) {
+	IGD_ASSERT(fw != 0);
+
+	if (module >= 0) {
+		IGD_(file_writer_dec)(fw, module);
+		IGD_(file_writer_char)(fw, '+');
+	}
+
+	IGD_(file_writer_bytes)(fw, "0x", 2);
+	IGD_(file_writer_hex)(fw, addr);
+	IGD_(file_writer_char)(fw, ':');
+	IGD_(file_writer_dec)(fw, size);
+	IGD_(file_writer_char)(fw, ':');
+	IGD_(file_writer_dec)(fw, count);
+	if (gen != 0) {
+		IGD_(file_writer_char)(fw, ':');
+		IGD_(file_writer_dec)(fw, gen);
+	}
+	IGD_(file_writer_char)(fw, '\n');
+}
@@ -16,12 +16,10 @@
 #include "pub_tool_clientstate.h"
 
 // Chain Smart List: 1
-// Realloc Smart List: 2
+// Realloc Smart List: 2 (may be set with -DSMART_LIST_MODE)
+#ifndef SMART_LIST_MODE
 #define SMART_LIST_MODE 2
-
-// Calling an external function: 1
-// Expression built in IR: 2
-#define INSTR_INC_MODE 2
+#endif
 
 #define IGD_(str) VGAPPEND(vginstrgrind_,str)
 
@@ -34,20 +32,84 @@
 #define IGD_REALLOC(_cc,p,x)	VG_(realloc)((_cc),p,x)
 #define IGD_STRDUP(_cc,s)		VG_(strdup)((_cc),s)
 
+// Poison freed data to help catching use after free bugs.
+//#define IGD_DEBUG_FREE
+
 #define IGD_UNUSED(arg)			(void)arg;
+#ifdef IGD_DEBUG_FREE
 #define IGD_DATA_FREE(p,x)		\
 	do { 						\
 		VG_(memset)(p, 0x41, x);	\
 		IGD_FREE(p); 			\
 	} while (0)
+#else
+#define IGD_DATA_FREE(p,x)		IGD_FREE(p)
+#endif
 
+// Estimated bookkeeping of each block allocated with IGD_MALLOC,
+// used to report the memory saved by the slabs.
+#define IGD_MALLOC_OVERHEAD		(4 * sizeof(SizeT))
+
+#define IGD_BINARY_MAGIC "IGDB"
+#define IGD_BINARY_VERSION 2
+#define IGD_BINARY_COUNT_WIDTH 10 // Bytes of a padded LEB128 ULong.
+
+typedef struct _AddrHash		AddrHash;
+typedef struct _CommandLineOptions	CommandLineOptions;
+typedef struct _EdgeSite		EdgeSite;
+typedef struct _FileWriter		FileWriter;
+typedef struct _FileReader		FileReader;
+typedef struct _ProfileStat		ProfileStat;
+typedef struct _Slab			Slab;
 typedef struct _SmartHash		SmartHash;
 typedef struct _SmartList		SmartList;
 typedef struct _SmartValue		SmartValue;
 typedef struct _SmartSeek		SmartSeek;
+typedef struct _InstrBlock		InstrBlock;
 typedef struct _InstrGroup		InstrGroup;
 typedef struct _UniqueInstr 	UniqueInstr;
 
+typedef enum {
+	FMT_TEXT,   // One "0xaddr:size:count" line per instruction.
+	FMT_BINARY  // Sorted, delta and LEB128 encoded records (see format.c).
+} OutputFormat;
+
+typedef enum {
+	CNT_INLINE,  // Counters incremented by IR expressions.
+	CNT_CALL,    // Counters incremented by calls to helpers.
+	CNT_GUARDED  // Inline, guarded by a flag switched when counting stops.
+} CounterMode;
+
+struct _CommandLineOptions {
+	const HChar* instrs_infile;
+	Bool ignore_failed;
+	const HChar* instrs_outfile;
+	OutputFormat instrs_format;
+	Bool instrs_relative;
+	const HChar* mappings_outfile;
+	const HChar* groups_outfile;
+	const HChar* funcs_outfile;
+	const HChar* objs_outfile;
+	const HChar* edges_outfile;
+	Bool summary;
+	const HChar* summary_outfile;
+	Int summary_top;
+	Bool separate_threads;
+	Bool exit_counters;
+	Int counter_width;
+	CounterMode counter_mode;
+	Bool lazy_instrs;
+	Long dump_every_bb;
+	Int dump_interval;
+	Bool dump_incremental;
+	Bool collect_atstart;
+	const HChar* include_objs;
+	const HChar* exclude_objs;
+	const HChar* include_range;
+	Long sample_period;
+	Long sample_window;
+};
+
 struct _SmartValue {
 	Int index;
 	void* value;
@@ -55,34 +117,242 @@ struct _SmartValue {
 };
 
 struct _InstrGroup {
-	ULong exec_count;  // The number of times this group was executed.
-	SmartList* instrs; // The list of instructions of this group.
+	UInt id;           // Compact id, reused after the group is deleted.
+	Bool entry;        // The first group of a translation of its superblock.
+	ULong exec_count;  // The number of times this group was executed, or
+	                   // its side exit was taken (--exit-counters=yes),
+	                   // moved from its counter (counters.c) on flushes.
+	UniqueInstr** instrs; // The instructions of this group, set when its
+	UInt ninstrs;         // superblock is instrumented (groups.c).
+	Addr start;           // A lazy group (--lazy-instrs=yes) has the address
+	UInt gen;             // and generation of its first instruction and the
+	UChar* lengths;       // lengths of all of them, until it is materialized.
+	InstrGroup* next;  // The next group in the same superblock.
+};
+
+struct _InstrBlock {
+	Addr addr;          // The guest address of the superblock entry.
+	InstrGroup* groups; // The groups instrumented in this superblock.
+	InstrGroup* last;
+	UInt touched;       // Position in the touched list plus one (blocks.c).
+	UInt translations;  // The live translations sharing the block.
+	Bool translating;   // A translation is adding its first group.
 };
 
 struct _UniqueInstr {
 	Addr addr;
 	Int size;
+	UInt gen;         // The generation of the code at this address.
 	ULong exec_count; // The number of times this instruction was executed.
 };
 
+struct _ProfileStat {
+	HChar* name;   // Function or object.
+	Addr addr;     // Lowest executed address, or text address of objects.
+	ULong ninstrs; // Distinct instructions executed.
+	ULong count;   // Instructions executed.
+};
+
+/* from addrhash.c */
+AddrHash* IGD_(new_addr_hash)(Int size);
+void IGD_(delete_addr_hash)(AddrHash* ahash);
+void IGD_(addr_hash_clear)(AddrHash* ahash, void (*remove_value)(void*));
+Int IGD_(addr_hash_count)(AddrHash* ahash);
+Int IGD_(addr_hash_size)(AddrHash* ahash);
+Bool IGD_(addr_hash_is_empty)(AddrHash* ahash);
+void* IGD_(addr_hash_get)(AddrHash* ahash, Addr key);
+void* IGD_(addr_hash_put)(AddrHash* ahash, Addr key, void* value);
+void* IGD_(addr_hash_remove)(AddrHash* ahash, Addr key);
+Bool IGD_(addr_hash_contains)(AddrHash* ahash, Addr key);
+void IGD_(addr_hash_forall)(AddrHash* ahash, Bool (*func)(void*, void*), void* arg);
+
+/* from main.c */
+extern CommandLineOptions IGD_(clo);
+
+/* from counters.c */
+void IGD_(init_counters)(void);
+void IGD_(destroy_counters)(void);
+void IGD_(counters_reserve)(UInt id);
+void* IGD_(counter_addr)(UInt id);
+VG_REGPARM(1) void IGD_(spill_counter)(UInt id);
+ULong IGD_(take_counter)(UInt id);
+void IGD_(print_counters_stats)(void);
+
+/* from edges.c */
+void IGD_(init_edges)(void);
+void IGD_(destroy_edges)(void);
+EdgeSite* IGD_(edge_site)(UniqueInstr* src);
+ULong* IGD_(edge_counter)(EdgeSite* site, Addr dst);
+VG_REGPARM(2) void IGD_(count_edge)(EdgeSite* site, Addr dst);
+void IGD_(zero_edges)(void);
+void IGD_(scale_edges)(void);
+void IGD_(dump_edges)(const HChar* filename);
+void IGD_(print_edges_stats)(void);
+
+/* from filters.c */
+void IGD_(init_filters)(void);
+void IGD_(destroy_filters)(void);
+Bool IGD_(filters_enabled)(void);
+Bool IGD_(filter_block)(Addr addr);
+void IGD_(print_filters_stats)(void);
+
+/* from format.c */
+FileWriter* IGD_(new_file_writer)(const HChar* filename);
+FileWriter* IGD_(new_fd_file_writer)(Int fd);
+void IGD_(delete_file_writer)(FileWriter* fw);
+void IGD_(file_writer_bytes)(FileWriter* fw, const void* data, Int size);
+ULong IGD_(file_writer_offset)(FileWriter* fw);
+void IGD_(file_writer_char)(FileWriter* fw, HChar c);
+void IGD_(file_writer_uleb)(FileWriter* fw, ULong value);
+void IGD_(file_writer_hex)(FileWriter* fw, ULong value);
+void IGD_(file_writer_dec)(FileWriter* fw, ULong value);
+FileReader* IGD_(new_file_reader)(Int fd);
+void IGD_(delete_file_reader)(FileReader* fr);
+Int IGD_(file_reader_peek)(FileReader* fr, void* data, Int size);
+Bool IGD_(file_reader_bytes)(FileReader* fr, void* data, Int size);
+Bool IGD_(file_reader_uleb)(FileReader* fr, ULong* value);
+Bool IGD_(is_binary_file)(FileReader* fr);
+void IGD_(write_binary_header)(FileWriter* fw, Int nmodules);
+Int IGD_(read_binary_header)(FileReader* fr);
+void IGD_(write_binary_module)(FileWriter* fw, const HChar* name, Addr base, SizeT size);
+void IGD_(read_binary_module)(FileReader* fr, HChar** name, Addr* base, SizeT* size);
+void IGD_(write_binary_count)(FileWriter* fw, ULong nrecords);
+void IGD_(encode_binary_count)(UChar* buffer, ULong nrecords);
+ULong IGD_(read_binary_count)(FileReader* fr);
+void IGD_(write_binary_record)(FileWriter* fw, Addr* last, Addr addr, Int size, UInt gen, ULong count);
+void IGD_(read_binary_record)(FileReader* fr, Addr* last, Addr* addr, Int* size, UInt* gen, ULong* count);
+Bool IGD_(read_text_module)(FileReader* fr, Int* id, SizeT* size, HChar** name);
+void IGD_(write_text_module)(FileWriter* fw, Int id, SizeT size, const HChar* name);
+Bool IGD_(read_text_record)(FileReader* fr, Int* module, Addr* addr, Int* size, UInt* gen, ULong* count);
+void IGD_(write_text_record)(FileWriter* fw, Int module, Addr addr, Int size, UInt gen, ULong count);
+
+/* from aggregate.c */
+void IGD_(init_aggregates)(void);
+void IGD_(destroy_aggregates)(void);
+void IGD_(aggregate_group)(InstrGroup* group);
+void IGD_(zero_aggregates)(void);
+void IGD_(dump_groups)(const HChar* filename);
+void IGD_(dump_funcs_objs)(const HChar* funcs_filename, const HChar* objs_filename);
+void IGD_(scale_aggregates)(void);
+ProfileStat* IGD_(func_profiles)(Int* count);
+void IGD_(delete_profiles)(ProfileStat* stats, Int count);
+
+/* from blocks.c */
+void IGD_(init_blocks_pool)(void);
+void IGD_(destroy_blocks_pool)(void);
+InstrBlock* IGD_(new_block)(Addr addr);
+void IGD_(block_add_group)(InstrBlock* block, InstrGroup* group);
+VG_REGPARM(1) void IGD_(touch_block)(InstrBlock* block);
+void IGD_(flush_touched_blocks)(void);
+void IGD_(flush_all_blocks)(void);
+void IGD_(zero_all_blocks)(void);
+void IGD_(discard_block)(Addr addr);
+void IGD_(print_blocks_stats)(void);
+void IGD_(print_increments_stats)(void);
+
 /* from groups.c */
 void IGD_(init_groups_pool)(void);
 void IGD_(destroy_groups_pool)(void);
 InstrGroup* IGD_(new_group)(void);
+void IGD_(group_add_instr)(InstrGroup* group, Addr addr, Int size);
+void IGD_(close_group)(void);
+void IGD_(materialize_group)(InstrGroup* group);
+void IGD_(delete_group)(InstrGroup* group);
 void IGD_(flush_group)(InstrGroup* group);
+void IGD_(print_groups_stats)(void);
 
 /* from instrs.c */
 void IGD_(init_instrs_pool)(void);
 void IGD_(destroy_instrs_pool)(void);
 UniqueInstr* IGD_(get_instr)(Addr addr, Int size);
+UniqueInstr* IGD_(get_instr_gen)(Addr addr, Int size, UInt gen);
 UniqueInstr* IGD_(find_instr)(Addr addr);
 Addr IGD_(instr_addr)(UniqueInstr* instr);
 Int IGD_(instr_size)(UniqueInstr* instr);
 Bool IGD_(instrs_cmp)(UniqueInstr* i1, UniqueInstr* i2);
 void IGD_(print_instr)(UniqueInstr* instr);
 void IGD_(fprint_instr)(VgFile* fp, UniqueInstr* instr);
+void IGD_(add_instr_count)(Addr addr, Int size, UInt gen, ULong count);
 void IGD_(read_instrs)(Int fd);
+Int IGD_(instrs_count)(void);
+void IGD_(forall_instrs)(Bool (*func)(UniqueInstr*, void*), void* arg);
+void IGD_(zero_instrs)(void);
+Int IGD_(cmp_instrs_addr)(const void* p1, const void* p2);
+void IGD_(sort_instrs)(UniqueInstr** instrs, Int count);
+UniqueInstr** IGD_(sorted_instrs)(Int* count);
 void IGD_(dump_instrs)(const HChar* filename);
+void IGD_(dump_run_instrs)(const HChar* filename);
+void IGD_(dump_instrs_list)(const HChar* filename, UniqueInstr** instrs, Int count);
+void IGD_(print_dump_stats)(void);
+void IGD_(print_instrs_stats)(void);
+
+/* from modules.c */
+void IGD_(init_modules)(void);
+void IGD_(destroy_modules)(void);
+Int IGD_(add_input_module)(const HChar* name, Addr base, SizeT size);
+void IGD_(add_module_record)(Int handle, Addr offset, Int size, UInt gen, ULong count);
+void IGD_(zero_pending)(void);
+void IGD_(modules_changed)(void);
+void IGD_(resolve_modules)(void);
+void IGD_(write_text_modules)(FileWriter* fw);
+Int IGD_(module_offset)(Addr addr, Addr* offset);
+void IGD_(write_relative_records)(FileWriter* fw, UniqueInstr** instrs, Int count, Bool pending);
+Int IGD_(prepare_pending_modules)(void);
+Bool IGD_(pending_modules_overlap)(void);
+void IGD_(write_pending_binary_modules)(FileWriter* fw);
+void IGD_(write_pending_text_modules)(FileWriter* fw);
+void IGD_(write_pending_text_records)(FileWriter* fw);
+Int IGD_(pending_count)(void);
+void IGD_(collect_pending)(UniqueInstr*** next);
+
+/* from pages.c */
+void IGD_(init_pages_pool)(void);
+void IGD_(destroy_pages_pool)(void);
+void IGD_(mark_code)(Addr addr, SizeT size);
+UInt IGD_(code_generation)(Addr addr);
+void IGD_(mark_code_writable)(Addr addr, SizeT size);
+void IGD_(bump_code_generation)(Addr addr, SizeT size);
+
+/* from sampling.c */
+void IGD_(init_sampling)(void);
+Bool IGD_(sampling_enabled)(void);
+Bool IGD_(sampling_window)(void);
+Bool IGD_(check_sampling)(ULong blocks_done, Bool counting);
+void IGD_(zero_sampling)(void);
+ULong IGD_(sampled_count)(ULong count);
+void IGD_(scale_sampled_counts)(void);
+void IGD_(print_sampling_stats)(void);
+
+/* from snapshot.c */
+void IGD_(init_snapshots)(void);
+void IGD_(destroy_snapshots)(void);
+Bool IGD_(snapshots_enabled)(void);
+void IGD_(check_snapshot)(ULong blocks_done);
+void IGD_(snapshot_group)(InstrGroup* group);
+void IGD_(zero_snapshots)(void);
+void IGD_(take_snapshot)(void);
+
+/* from slab.c */
+Slab* IGD_(new_slab)(const HChar* cc, Int elem_size, Int per_chunk);
+void IGD_(delete_slab)(Slab* slab);
+void* IGD_(slab_alloc)(Slab* slab);
+void IGD_(slab_free)(Slab* slab, void* elem);
+Int IGD_(slab_count)(Slab* slab);
+SizeT IGD_(slab_bytes)(Slab* slab);
+
+/* from summary.c */
+void IGD_(write_summary)(const HChar* filename);
+
+/* from threads.c */
+extern ULong* IGD_(current_counters);
+void IGD_(init_threads)(void);
+void IGD_(destroy_threads)(void);
+void IGD_(switch_thread)(ThreadId tid);
+void IGD_(threads_reserve)(UInt id);
+void IGD_(zero_threads)(void);
+void IGD_(scale_threads)(void);
+void IGD_(flush_thread_block)(InstrBlock* block);
+void IGD_(dump_threads_instrs)(const HChar* filename);
 
 /* from smarthash.c */
 SmartHash* IGD_(new_smart_hash)(Int size);
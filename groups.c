@@ -28,62 +28,343 @@
 
 #include "global.h"
 
-#define DEFAULT_POOL_SIZE 131072 // 128k groups
+/*
+   The instructions of a group are only known when its superblock is
+   instrumented, and do not change after that. They are collected in a
+   staging buffer while the group is open and then copied to an array of
+   the exact size, carved from a slab for that size (the superblocks are
+   short, so most groups fit the small sizes) or allocated if larger.
 
-SmartList* groups_pool = 0;
+   With --lazy-instrs=yes the instructions are not looked up while the
+   code is translated. A group of consecutive instructions of the same
+   code generation only keeps the address of the first one, the
+   generation and the length of each one, and its instructions are
+   created when it is flushed with a count, so the code executed only a
+   few times, or never after being translated, costs no hash lookups.
+   Other groups (rare, when the superblock follows a jump inside a group)
+   get their instructions when they are closed.
+*/
 
-static
-void delete_group(InstrGroup* group) {
-	IGD_ASSERT(group != 0);
+#define GROUPS_PER_SLAB 16384
+#define ARRAY_SLABS 32       // Slabs for the arrays of 8 to 256 bytes.
+#define ARRAYS_PER_SLAB 1024
+#define STAGING_SIZE 64
 
-	IGD_(flush_group)(group);
+typedef struct _StagedInstr	StagedInstr;
+struct _StagedInstr {
+	Addr addr;
+	Int size;
+	UInt gen;
+	UniqueInstr* instr; // Null while lazy.
+};
 
-	IGD_(smart_list_clear)(group->instrs, 0);
-	IGD_(delete_smart_list)(group->instrs);
+// The live groups are owned by the superblocks (blocks.c), the slab
+// only provides and recycles their storage.
+Slab* groups_slab = 0;
 
-	IGD_DATA_FREE(group, sizeof(InstrGroup*));
-}
+// The ids of the deleted groups are reused, so the ids stay compact and
+// can index the counters (counters.c) and the per thread ones (threads.c).
+static UInt next_id = 0;
+static UInt* free_ids = 0;
+static Int free_ids_count = 0;
+static Int free_ids_size = 0;
+
+static Slab* array_slabs[ARRAY_SLABS + 1]; // By size, in units of 8 bytes.
+
+// The group being instrumented and its instructions.
+static InstrGroup* open_group = 0;
+static StagedInstr* staging = 0;
+static Int staging_count = 0;
+static Int staging_size = 0;
+
+static ULong lazy_groups = 0;
+static ULong materialized_groups = 0;
 
 void IGD_(init_groups_pool)() {
-	IGD_ASSERT(groups_pool == 0);
+	IGD_ASSERT(groups_slab == 0);
+
+	groups_slab = IGD_(new_slab)("igd.groups.ng.1", sizeof(InstrGroup), GROUPS_PER_SLAB);
+
+	next_id = 0;
+	free_ids_count = 0;
+	free_ids_size = 1024;
+	free_ids = (UInt*) IGD_MALLOC("igd.groups.ng.2", (free_ids_size * sizeof(UInt)));
+
+	VG_(memset)(array_slabs, 0, sizeof(array_slabs));
 
-	groups_pool = IGD_(new_smart_list)(DEFAULT_POOL_SIZE);
+	open_group = 0;
+	staging_count = 0;
+	staging_size = STAGING_SIZE;
+	staging = (StagedInstr*) IGD_MALLOC("igd.groups.ng.3",
+						(staging_size * sizeof(StagedInstr)));
+
+	lazy_groups = 0;
+	materialized_groups = 0;
 }
 
 void IGD_(destroy_groups_pool)() {
-	IGD_ASSERT(groups_pool != 0);
+	Int i;
+
+	IGD_ASSERT(groups_slab != 0);
+	IGD_ASSERT(open_group == 0);
+
+	IGD_(delete_slab)(groups_slab);
+	groups_slab = 0;
+
+	for (i = 1; i <= ARRAY_SLABS; i++) {
+		if (array_slabs[i]) {
+			IGD_(delete_slab)(array_slabs[i]);
+			array_slabs[i] = 0;
+		}
+	}
+
+	IGD_FREE(staging);
+	staging = 0;
+	staging_count = 0;
+	staging_size = 0;
+
+	IGD_FREE(free_ids);
+	free_ids = 0;
+	free_ids_count = 0;
+	free_ids_size = 0;
+}
+
+static
+UInt new_group_id(void) {
+	if (free_ids_count > 0)
+		return free_ids[--free_ids_count];
+
+	return next_id++;
+}
+
+static
+void delete_group_id(UInt id) {
+	if (free_ids_count == free_ids_size) {
+		free_ids_size *= 2;
+		free_ids = (UInt*) IGD_REALLOC("igd.groups.dgi.1", free_ids,
+								(free_ids_size * sizeof(UInt)));
+	}
+
+	free_ids[free_ids_count++] = id;
+}
+
+static
+void* new_array(SizeT bytes) {
+	Int units;
+
+	if (bytes == 0)
+		return 0;
+
+	units = (bytes + 7) / 8;
+	if (units > ARRAY_SLABS)
+		return IGD_MALLOC("igd.groups.na.1", bytes);
+
+	if (!array_slabs[units])
+		array_slabs[units] = IGD_(new_slab)("igd.groups.na.2", units * 8, ARRAYS_PER_SLAB);
+
+	return IGD_(slab_alloc)(array_slabs[units]);
+}
+
+static
+void delete_array(void* array, SizeT bytes) {
+	Int units;
+
+	if (bytes == 0)
+		return;
+
+	units = (bytes + 7) / 8;
+	if (units > ARRAY_SLABS)
+		IGD_FREE(array);
+	else
+		IGD_(slab_free)(array_slabs[units], array);
+}
+
+// Whether the staged instructions can be kept as a lazy group.
+static
+Bool lazy_staging(void) {
+	Int i;
+
+	if (!IGD_(clo).lazy_instrs || staging_count == 0)
+		return False;
+
+	for (i = 0; i < staging_count; i++) {
+		if (staging[i].size <= 0 || staging[i].size > 255 ||
+				staging[i].gen != staging[0].gen)
+			return False;
 
-	IGD_(smart_list_clear)(groups_pool, (void (*)(void*)) delete_group);
-	IGD_(delete_smart_list)(groups_pool);
-	groups_pool = 0;
+		if (i > 0 && staging[i].addr != staging[i - 1].addr + staging[i - 1].size)
+			return False;
+	}
+
+	return True;
+}
+
+// Store the instructions of the open group, once it is complete.
+void IGD_(close_group)(void) {
+	Int i;
+	InstrGroup* group;
+
+	if (!open_group)
+		return;
+
+	group = open_group;
+	group->ninstrs = staging_count;
+
+	if (lazy_staging()) {
+		group->start = staging[0].addr;
+		group->gen = staging[0].gen;
+		group->lengths = (UChar*) new_array(staging_count);
+		for (i = 0; i < staging_count; i++)
+			group->lengths[i] = (UChar) staging[i].size;
+
+		lazy_groups++;
+	} else {
+		group->instrs = (UniqueInstr**) new_array(staging_count * sizeof(UniqueInstr*));
+		for (i = 0; i < staging_count; i++) {
+			group->instrs[i] = staging[i].instr ? staging[i].instr :
+				IGD_(get_instr_gen)(staging[i].addr, staging[i].size, staging[i].gen);
+		}
+	}
+
+	open_group = 0;
+	staging_count = 0;
 }
 
+// Add an instruction to the group being instrumented.
+void IGD_(group_add_instr)(InstrGroup* group, Addr addr, Int size) {
+	StagedInstr* staged;
+
+	IGD_ASSERT(group == open_group);
+
+	if (staging_count == staging_size) {
+		staging_size *= 2;
+		staging = (StagedInstr*) IGD_REALLOC("igd.groups.gai.1", staging,
+								(staging_size * sizeof(StagedInstr)));
+	}
+
+	staged = &staging[staging_count++];
+	staged->addr = addr;
+	staged->size = size;
+	if (IGD_(clo).lazy_instrs) {
+		staged->gen = IGD_(code_generation)(addr);
+		staged->instr = 0;
+	} else {
+		staged->instr = IGD_(get_instr)(addr, size);
+		staged->gen = staged->instr->gen;
+	}
+}
+
+// Create the instructions of a lazy group.
+void IGD_(materialize_group)(InstrGroup* group) {
+	UInt i;
+	Addr addr;
+	UniqueInstr** instrs;
+
+	if (!group->lengths)
+		return;
+
+	instrs = (UniqueInstr**) new_array(group->ninstrs * sizeof(UniqueInstr*));
+
+	addr = group->start;
+	for (i = 0; i < group->ninstrs; i++) {
+		instrs[i] = IGD_(get_instr_gen)(addr, group->lengths[i], group->gen);
+		addr += group->lengths[i];
+	}
+
+	delete_array(group->lengths, group->ninstrs);
+	group->lengths = 0;
+	group->instrs = instrs;
+
+	materialized_groups++;
+}
+
+// The group is open for instructions until the next one is created or
+// IGD_(close_group) is called.
 InstrGroup* IGD_(new_group)() {
 	InstrGroup* group;
 
-	group = (InstrGroup*) IGD_MALLOC("igd.groups.ng.1", sizeof(InstrGroup));
+	IGD_(close_group)();
+
+	group = (InstrGroup*) IGD_(slab_alloc)(groups_slab);
+	group->id = new_group_id();
+	group->entry = False;
 	group->exec_count = 0;
-	group->instrs = IGD_(new_smart_list)(10);
+	group->instrs = 0;
+	group->ninstrs = 0;
+	group->start = 0;
+	group->gen = 0;
+	group->lengths = 0;
+	group->next = 0;
+
+	open_group = group;
 
-	IGD_(smart_list_add)(groups_pool, group);
+	if (IGD_(clo).separate_threads)
+		IGD_(threads_reserve)(group->id);
+	else
+		IGD_(counters_reserve)(group->id);
 
 	return group;
 }
 
+// Flush the execution count of the group and release it for reuse.
+void IGD_(delete_group)(InstrGroup* group) {
+	IGD_ASSERT(group != 0);
+
+	IGD_ASSERT(group != open_group);
+
+	IGD_(flush_group)(group);
+
+	if (group->lengths)
+		delete_array(group->lengths, group->ninstrs);
+	else
+		delete_array(group->instrs, group->ninstrs * sizeof(UniqueInstr*));
+
+	delete_group_id(group->id);
+	IGD_(slab_free)(groups_slab, group);
+}
+
 void IGD_(flush_group)(InstrGroup* group) {
-	Int i, size;
+	UInt i;
+	ULong count;
+	UniqueInstr** instrs;
 
 	IGD_ASSERT(group != 0);
 
-	size = IGD_(smart_list_count)(group->instrs);
-	for (i = 0; i < size; i++) {
-		UniqueInstr* instr;
+	count = group->exec_count;
+	if (count == 0)
+		return;
 
-		instr = IGD_(smart_list_at)(group->instrs, i);
-		IGD_ASSERT(instr != 0);
+	IGD_(materialize_group)(group);
+	IGD_(aggregate_group)(group);
 
-		instr->exec_count += group->exec_count;
-	}
+	instrs = group->instrs;
+	for (i = 0; i < group->ninstrs; i++)
+		instrs[i]->exec_count += count;
 
 	group->exec_count = 0;
 }
+
+void IGD_(print_groups_stats)(void) {
+	Int i, count;
+	SizeT array_bytes;
+
+	IGD_ASSERT(groups_slab != 0);
+
+	count = IGD_(slab_count)(groups_slab);
+	VG_(dmsg)("groups: %'d live instruction groups, %'lu bytes in slabs"
+		" (%'lu bytes as separate blocks)\n", count,
+		IGD_(slab_bytes)(groups_slab),
+		count * (sizeof(InstrGroup) + IGD_MALLOC_OVERHEAD));
+
+	array_bytes = 0;
+	for (i = 1; i <= ARRAY_SLABS; i++) {
+		if (array_slabs[i])
+			array_bytes += IGD_(slab_bytes)(array_slabs[i]);
+	}
+
+	VG_(dmsg)("groups: %'lu bytes of instruction arrays in slabs\n", array_bytes);
+
+	if (IGD_(clo).lazy_instrs)
+		VG_(dmsg)("groups: %'llu lazy groups, %'llu materialized so far\n",
+			lazy_groups, materialized_groups);
+}
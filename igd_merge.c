@@ -0,0 +1,949 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                  igd_merge.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+   igd_merge: merge the instruction counts of many runs (or of the
+   processes of a single run) into one file, outside valgrind. It is built
+   for the host against the libc shim in tests/host, so it shares the file
+   formats code (format.c) with the tool.
+
+   The inputs are merged in a streaming fashion: a heap holds the current
+   record of each input and the records with the same key are summed as
+   they come out, so the memory is bounded by the buffers of the open
+   files. At most MAX_FANIN files are merged at once; with more inputs
+   (or with -j) groups of them are merged to intermediate files first,
+   in parallel threads with -j, and these are merged in turn.
+
+   Records are keyed by (module, address, generation). Absolute addresses
+   come first, then the module relative ones ordered by the module name
+   and text size, which is also the order of the ids in the merged module
+   table. The table has one module per name and text size, whatever its
+   load address in each file, so the records of a binary file inside its
+   modules are rebased to (module, offset) with the file's own table and
+   the runs of a program loaded at different addresses are summed.
+   A binary output has absolute addresses again: each module is placed at
+   its lowest load address in the inputs, which must not overlap.
+   The rebased records of a file are no longer in the order of its
+   addresses, so they are sorted in memory, unless the file already has
+   the output addresses. Text files that are not sorted must be given
+   with -s, to be sorted in memory first.
+
+   Usage: igd_merge [-o outfile] [-f text|binary] [-s] [-j jobs]
+                    [-T tmpdir] file...
+*/
+
+#include <errno.h>
+#include <pthread.h>
+
+#include "global.h"
+
+#define MAX_FANIN 64
+#define RECORDS_INITIAL 65536
+#define MODULES_INITIAL 64
+#define TEMPS_INITIAL 16
+
+SizeT igd_host_cur_bytes = 0;
+SizeT igd_host_peak_bytes = 0;
+
+typedef struct {
+	Int module; // Merged module id, or -1 for an absolute address.
+	Addr addr;
+	Int size;
+	UInt gen;
+	ULong count;
+} Record;
+
+typedef struct {
+	HChar* name;
+	Addr base;  // Lowest load address in the binary files, or 0.
+	SizeT size;
+} Module;
+
+typedef struct {
+	Module* modules;
+	Int count;
+	Int max;
+} ModuleTable;
+
+// A module of a binary file, at its load address in that file.
+typedef struct {
+	Addr base;
+	SizeT size;
+	Int id; // Merged module id.
+} FileModule;
+
+typedef struct {
+	const HChar* filename;
+	Int fd;
+	FileReader* fr;
+	Bool binary;
+	ULong remaining; // The records left in a binary file.
+	Addr last;       // The previous address in a binary file.
+	Int* map;        // Text module id -> merged module id.
+	Int nmap;
+	FileModule* fmods; // The modules of a binary file, by address.
+	Int nfmods;
+	Bool rebase;     // The records are moved to the output addresses.
+	Record* records; // All the records, sorted in memory (-s).
+	Long nrecords;
+	Long next;
+	Bool started;
+	Record cur;
+} Input;
+
+typedef struct {
+	const HChar** inputs;
+	Int ninputs;
+	const HChar* outfile; // The standard output if null.
+	Bool sort;
+} MergeTask;
+
+typedef struct {
+	MergeTask* tasks;
+	Int ntasks;
+	Int next;
+	pthread_mutex_t lock;
+} TaskQueue;
+
+static OutputFormat out_format = FMT_TEXT;
+static Int jobs = 1;
+static const HChar* tmpdir = 0;
+
+// The merged modules of all the files, complete before any record is
+// merged.
+static ModuleTable modules = { 0, 0, 0 };
+
+// The intermediate files, removed on errors too. They are only created
+// by the main thread, between the merges.
+static HChar** temp_files = 0;
+static Int temp_count = 0;
+static Int temp_max = 0;
+
+static __attribute__((noreturn, format(printf, 1, 2)))
+void fatal(const HChar* format, ...) {
+	Int i;
+	va_list vargs;
+
+	fprintf(stderr, "igd_merge: ");
+	va_start(vargs, format);
+	vfprintf(stderr, format, vargs);
+	va_end(vargs);
+	fprintf(stderr, "\n");
+
+	for (i = 0; i < temp_count; i++)
+		unlink(temp_files[i]);
+
+	exit(1);
+}
+
+static
+void usage(void) {
+	fprintf(stderr,
+		"usage: igd_merge [options] file...\n"
+		"    -o <file>          write the merged counts to <file> [stdout]\n"
+		"    -f text|binary     format of the merged file [text]\n"
+		"    -s                 sort the inputs in memory (unsorted text files)\n"
+		"    -j <n>             merge groups of inputs in <n> threads [1]\n"
+		"    -T <dir>           directory of the intermediate files [$TMPDIR or /tmp]\n");
+	exit(1);
+}
+
+static
+Int open_file(const HChar* filename) {
+	Int fd;
+
+	fd = VG_(fd_open)(filename, VKI_O_RDONLY, 0);
+	if (fd < 0)
+		fatal("unable to open %s: %s", filename, strerror(errno));
+
+	return fd;
+}
+
+// The key of the merged modules.
+static
+Int cmp_module_keys(const void* p1, const void* p2) {
+	const Module* m1 = (const Module*) p1;
+	const Module* m2 = (const Module*) p2;
+	Int r;
+
+	r = VG_(strcmp)(m1->name, m2->name);
+	if (r != 0)
+		return r;
+
+	if (m1->size != m2->size)
+		return m1->size < m2->size ? -1 : 1;
+
+	return 0;
+}
+
+static
+Int cmp_modules(const void* p1, const void* p2) {
+	const Module* m1 = (const Module*) p1;
+	const Module* m2 = (const Module*) p2;
+	Int r;
+
+	r = cmp_module_keys(p1, p2);
+	if (r != 0)
+		return r;
+
+	if (m1->base != m2->base)
+		return m1->base < m2->base ? -1 : 1;
+
+	return 0;
+}
+
+static
+Int cmp_module_bases(const void* p1, const void* p2) {
+	const Module* m1 = *((const Module**) p1);
+	const Module* m2 = *((const Module**) p2);
+
+	if (m1->base != m2->base)
+		return m1->base < m2->base ? -1 : 1;
+
+	return 0;
+}
+
+static
+Int cmp_file_modules(const void* p1, const void* p2) {
+	const FileModule* m1 = (const FileModule*) p1;
+	const FileModule* m2 = (const FileModule*) p2;
+
+	if (m1->base != m2->base)
+		return m1->base < m2->base ? -1 : 1;
+
+	return 0;
+}
+
+// The table takes the name.
+static
+void add_module(ModuleTable* table, HChar* name, Addr base, SizeT size) {
+	if (table->count == table->max) {
+		table->max = table->max ? (table->max * 2) : MODULES_INITIAL;
+		table->modules = (Module*) IGD_REALLOC("igd.merge.am.1", table->modules,
+								(table->max * sizeof(Module)));
+	}
+
+	table->modules[table->count].name = name;
+	table->modules[table->count].base = base;
+	table->modules[table->count].size = size;
+	table->count++;
+}
+
+// Sort the table and keep one module per name and text size, at its
+// lowest load address in the binary files.
+static
+void finish_modules(ModuleTable* table) {
+	Int i, n;
+	Module* prev;
+
+	if (table->count == 0)
+		return;
+
+	VG_(ssort)(table->modules, table->count, sizeof(Module), cmp_modules);
+
+	n = 1;
+	for (i = 1; i < table->count; i++) {
+		prev = &table->modules[n - 1];
+		if (cmp_module_keys(prev, &table->modules[i]) == 0) {
+			if (prev->base == 0)
+				prev->base = table->modules[i].base;
+			IGD_FREE(table->modules[i].name);
+		} else {
+			table->modules[n++] = table->modules[i];
+		}
+	}
+	table->count = n;
+}
+
+// A binary output places every module at its address, so these must be
+// known and must not overlap.
+static
+void check_binary_modules(void) {
+	Int i;
+	Module** sorted;
+
+	if (modules.count == 0)
+		return;
+
+	sorted = (Module**) IGD_MALLOC("igd.merge.cbm.1", (modules.count * sizeof(Module*)));
+	for (i = 0; i < modules.count; i++) {
+		if (modules.modules[i].base == 0)
+			fatal("%s is only in module relative text files, merge to text",
+					modules.modules[i].name);
+
+		sorted[i] = &modules.modules[i];
+	}
+
+	VG_(ssort)(sorted, modules.count, sizeof(Module*), cmp_module_bases);
+	for (i = 1; i < modules.count; i++) {
+		if ((sorted[i - 1]->base + sorted[i - 1]->size) > sorted[i]->base)
+			fatal("%s and %s overlap at their lowest load addresses, merge to text",
+					sorted[i - 1]->name, sorted[i]->name);
+	}
+
+	IGD_FREE(sorted);
+}
+
+static
+void delete_modules(ModuleTable* table) {
+	Int i;
+
+	for (i = 0; i < table->count; i++)
+		IGD_FREE(table->modules[i].name);
+
+	IGD_FREE(table->modules);
+	table->modules = 0;
+	table->count = table->max = 0;
+}
+
+static
+Int find_module(const HChar* name, SizeT size) {
+	Module key;
+	Module* found;
+
+	key.name = (HChar*) name;
+	key.base = 0;
+	key.size = size;
+
+	found = (Module*) bsearch(&key, modules.modules, modules.count,
+					sizeof(Module), cmp_module_keys);
+	IGD_ASSERT(found != 0);
+
+	return found - modules.modules;
+}
+
+// The module of a binary file holding an address, if any.
+static
+FileModule* find_file_module(Input* in, Addr addr) {
+	Int low, high, mid;
+
+	low = 0;
+	high = in->nfmods - 1;
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (addr < in->fmods[mid].base)
+			high = mid - 1;
+		else if (addr >= (in->fmods[mid].base + in->fmods[mid].size))
+			low = mid + 1;
+		else
+			return &in->fmods[mid];
+	}
+
+	return 0;
+}
+
+// Read the module tables of an input, before the merge.
+static
+void scan_modules(const HChar* filename) {
+	Int fd, i, n, id;
+	Addr base;
+	SizeT size;
+	HChar* name;
+	FileReader* fr;
+
+	fd = open_file(filename);
+	fr = IGD_(new_file_reader)(fd);
+
+	if (IGD_(is_binary_file)(fr)) {
+		n = IGD_(read_binary_header)(fr);
+		for (i = 0; i < n; i++) {
+			IGD_(read_binary_module)(fr, &name, &base, &size);
+			add_module(&modules, name, base, size);
+		}
+	} else {
+		while (IGD_(read_text_module)(fr, &id, &size, &name))
+			add_module(&modules, name, 0, size);
+	}
+
+	IGD_(delete_file_reader)(fr);
+	VG_(close)(fd);
+}
+
+static
+Int cmp_records(const Record* r1, const Record* r2) {
+	if (r1->module != r2->module)
+		return r1->module < r2->module ? -1 : 1;
+
+	if (r1->addr != r2->addr)
+		return r1->addr < r2->addr ? -1 : 1;
+
+	if (r1->gen != r2->gen)
+		return r1->gen < r2->gen ? -1 : 1;
+
+	return 0;
+}
+
+// Move a record to the addresses of the output: a module offset for a
+// text output, its address in the merged modules for a binary one.
+static
+void rebase_record(Input* in, Record* rec) {
+	FileModule* fmod;
+
+	if (in->binary) {
+		fmod = find_file_module(in, rec->addr);
+		if (!fmod)
+			return;
+
+		rec->module = fmod->id;
+		rec->addr -= fmod->base;
+	}
+
+	if (rec->module >= 0 && out_format == FMT_BINARY) {
+		rec->addr += modules.modules[rec->module].base;
+		rec->module = -1;
+	}
+}
+
+static
+Bool read_record(Input* in, Record* rec) {
+	Int module;
+
+	if (in->records) {
+		if (in->next == in->nrecords)
+			return False;
+
+		*rec = in->records[in->next++];
+		return True;
+	}
+
+	if (in->binary) {
+		if (in->remaining == 0)
+			return False;
+
+		IGD_(read_binary_record)(in->fr, &in->last, &rec->addr, &rec->size,
+						&rec->gen, &rec->count);
+		rec->module = -1;
+		in->remaining--;
+	} else {
+		if (!IGD_(read_text_record)(in->fr, &module, &rec->addr, &rec->size,
+						&rec->gen, &rec->count))
+			return False;
+
+		if (module >= 0) {
+			if (module >= in->nmap || in->map[module] < 0)
+				fatal("%s: record of the undeclared module %d", in->filename, module);
+
+			module = in->map[module];
+		}
+		rec->module = module;
+	}
+
+	if (in->rebase)
+		rebase_record(in, rec);
+
+	return True;
+}
+
+static
+void load_records(Input* in) {
+	Long count, max;
+	Record* records;
+	Record rec;
+
+	max = RECORDS_INITIAL;
+	records = (Record*) IGD_MALLOC("igd.merge.lr.1", (max * sizeof(Record)));
+
+	count = 0;
+	while (read_record(in, &rec)) {
+		if (count == max) {
+			max *= 2;
+			records = (Record*) IGD_REALLOC("igd.merge.lr.2", records,
+								(max * sizeof(Record)));
+		}
+
+		records[count++] = rec;
+	}
+
+	VG_(ssort)(records, count, sizeof(Record),
+			(Int (*)(const void*, const void*)) cmp_records);
+
+	in->records = records;
+	in->nrecords = count;
+	in->next = 0;
+}
+
+static
+void open_input(Input* in, const HChar* filename, Bool sort) {
+	Int i, n, id;
+	Addr base;
+	SizeT size;
+	HChar* name;
+
+	VG_(memset)(in, 0, sizeof(Input));
+	in->filename = filename;
+	in->fd = open_file(filename);
+	in->fr = IGD_(new_file_reader)(in->fd);
+	in->binary = IGD_(is_binary_file)(in->fr);
+
+	if (in->binary) {
+		n = IGD_(read_binary_header)(in->fr);
+		if (n > 0)
+			in->fmods = (FileModule*) IGD_MALLOC("igd.merge.oi.2", (n * sizeof(FileModule)));
+
+		for (i = 0; i < n; i++) {
+			IGD_(read_binary_module)(in->fr, &name, &base, &size);
+
+			in->fmods[i].base = base;
+			in->fmods[i].size = size;
+			in->fmods[i].id = find_module(name, size);
+			IGD_FREE(name);
+
+			// A text output has module offsets, a binary one has the
+			// merged module addresses: nothing moves if these are the
+			// addresses of the file.
+			if (out_format == FMT_TEXT || base != modules.modules[in->fmods[i].id].base)
+				in->rebase = True;
+		}
+		in->nfmods = n;
+
+		VG_(ssort)(in->fmods, in->nfmods, sizeof(FileModule), cmp_file_modules);
+		for (i = 1; i < in->nfmods; i++) {
+			if ((in->fmods[i - 1].base + in->fmods[i - 1].size) > in->fmods[i].base)
+				fatal("%s: overlapping modules", filename);
+		}
+
+		in->remaining = IGD_(read_binary_count)(in->fr);
+		in->last = 0;
+	} else {
+		while (IGD_(read_text_module)(in->fr, &id, &size, &name)) {
+			if (id < 0)
+				fatal("%s: invalid module id %d", filename, id);
+
+			if (id >= in->nmap) {
+				n = in->nmap;
+				in->nmap = (id + 1) * 2;
+				in->map = (Int*) IGD_REALLOC("igd.merge.oi.1", in->map,
+								(in->nmap * sizeof(Int)));
+				for (; n < in->nmap; n++)
+					in->map[n] = -1;
+			}
+
+			in->map[id] = find_module(name, size);
+			IGD_FREE(name);
+		}
+
+		// The module offsets become addresses in a binary output.
+		if (out_format == FMT_BINARY && in->nmap > 0)
+			in->rebase = True;
+	}
+
+	// The rebased records are out of the order of the file.
+	if (sort || in->rebase) {
+		load_records(in);
+
+		IGD_(delete_file_reader)(in->fr);
+		in->fr = 0;
+		VG_(close)(in->fd);
+		in->fd = -1;
+	}
+}
+
+static
+void close_input(Input* in) {
+	if (in->fr) {
+		IGD_(delete_file_reader)(in->fr);
+		VG_(close)(in->fd);
+	}
+
+	if (in->map)
+		IGD_FREE(in->map);
+
+	if (in->fmods)
+		IGD_FREE(in->fmods);
+
+	if (in->records)
+		IGD_FREE(in->records);
+}
+
+// Move to the next record of the input, checking the order.
+static
+Bool next_record(Input* in) {
+	Record prev;
+
+	prev = in->cur;
+	if (!read_record(in, &in->cur))
+		return False;
+
+	if (in->started && cmp_records(&in->cur, &prev) < 0)
+		fatal("%s is not sorted, merge it with -s", in->filename);
+	in->started = True;
+
+	return True;
+}
+
+static
+void sift_down(Input** heap, Int count, Int pos) {
+	Int child;
+	Input* tmp;
+
+	while ((child = (2 * pos) + 1) < count) {
+		if ((child + 1) < count &&
+				cmp_records(&heap[child + 1]->cur, &heap[child]->cur) < 0)
+			child++;
+
+		if (cmp_records(&heap[pos]->cur, &heap[child]->cur) <= 0)
+			break;
+
+		tmp = heap[pos];
+		heap[pos] = heap[child];
+		heap[child] = tmp;
+
+		pos = child;
+	}
+}
+
+static
+void write_record(FileWriter* fw, Addr* last, Record* rec) {
+	if (out_format == FMT_BINARY) {
+		IGD_ASSERT(rec->module < 0);
+		IGD_(write_binary_record)(fw, last, rec->addr, rec->size, rec->gen, rec->count);
+	} else {
+		IGD_(write_text_record)(fw, rec->module, rec->addr, rec->size, rec->gen, rec->count);
+	}
+}
+
+// Write the padded count of a binary file, once it is known.
+static
+void patch_binary_count(const HChar* filename, ULong offset, ULong count) {
+	Int fd;
+	UChar buffer[IGD_BINARY_COUNT_WIDTH];
+
+	fd = VG_(fd_open)(filename, VKI_O_WRONLY, 0);
+	if (fd < 0)
+		fatal("unable to reopen %s: %s", filename, strerror(errno));
+
+	IGD_(encode_binary_count)(buffer, count);
+	if (pwrite(fd, buffer, sizeof(buffer), offset) != sizeof(buffer))
+		fatal("unable to write %s: %s", filename, strerror(errno));
+
+	VG_(close)(fd);
+}
+
+static
+void merge_files(MergeTask* task) {
+	Int i, count;
+	Input* inputs;
+	Input** heap;
+	Input* in;
+	Addr last;
+	ULong offset, nrecords;
+	Bool pending;
+	Record out;
+	FileWriter* fw;
+	UChar buffer[IGD_BINARY_COUNT_WIDTH];
+
+	inputs = (Input*) IGD_MALLOC("igd.merge.mf.1", (task->ninputs * sizeof(Input)));
+	heap = (Input**) IGD_MALLOC("igd.merge.mf.2", (task->ninputs * sizeof(Input*)));
+
+	count = 0;
+	for (i = 0; i < task->ninputs; i++) {
+		open_input(&inputs[i], task->inputs[i], task->sort);
+		if (next_record(&inputs[i]))
+			heap[count++] = &inputs[i];
+	}
+
+	for (i = (count / 2) - 1; i >= 0; i--)
+		sift_down(heap, count, i);
+
+	// The standard output is written as it is, not reopened, so what was
+	// already written to its file is kept.
+	if (task->outfile)
+		fw = IGD_(new_file_writer)(task->outfile);
+	else
+		fw = IGD_(new_fd_file_writer)(1);
+
+	offset = 0;
+	if (out_format == FMT_BINARY) {
+		IGD_(write_binary_header)(fw, modules.count);
+		for (i = 0; i < modules.count; i++)
+			IGD_(write_binary_module)(fw, modules.modules[i].name,
+					modules.modules[i].base, modules.modules[i].size);
+
+		offset = IGD_(file_writer_offset)(fw);
+		IGD_(encode_binary_count)(buffer, 0);
+		IGD_(file_writer_bytes)(fw, buffer, sizeof(buffer));
+	} else {
+		for (i = 0; i < modules.count; i++)
+			IGD_(write_text_module)(fw, i, modules.modules[i].size,
+					modules.modules[i].name);
+	}
+
+	last = 0;
+	nrecords = 0;
+	pending = False;
+	while (count > 0) {
+		in = heap[0];
+
+		if (pending && cmp_records(&out, &in->cur) == 0) {
+			out.count += in->cur.count;
+		} else {
+			if (pending) {
+				write_record(fw, &last, &out);
+				nrecords++;
+			}
+
+			out = in->cur;
+			pending = True;
+		}
+
+		if (!next_record(in))
+			heap[0] = heap[--count];
+		sift_down(heap, count, 0);
+	}
+
+	if (pending) {
+		write_record(fw, &last, &out);
+		nrecords++;
+	}
+
+	IGD_(delete_file_writer)(fw);
+
+	if (out_format == FMT_BINARY)
+		patch_binary_count(task->outfile, offset, nrecords);
+
+	for (i = 0; i < task->ninputs; i++)
+		close_input(&inputs[i]);
+
+	IGD_FREE(heap);
+	IGD_FREE(inputs);
+}
+
+static
+void* merge_worker(void* arg) {
+	Int i;
+	TaskQueue* queue = (TaskQueue*) arg;
+
+	for (;;) {
+		pthread_mutex_lock(&queue->lock);
+		i = queue->next++;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (i >= queue->ntasks)
+			break;
+
+		merge_files(&queue->tasks[i]);
+	}
+
+	return 0;
+}
+
+static
+void run_tasks(MergeTask* tasks, Int ntasks) {
+	Int i, nthreads;
+	pthread_t threads[ntasks];
+	TaskQueue queue;
+
+	nthreads = jobs < ntasks ? jobs : ntasks;
+	if (nthreads <= 1) {
+		for (i = 0; i < ntasks; i++)
+			merge_files(&tasks[i]);
+
+		return;
+	}
+
+	queue.tasks = tasks;
+	queue.ntasks = ntasks;
+	queue.next = 0;
+	pthread_mutex_init(&queue.lock, 0);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], 0, merge_worker, &queue) != 0)
+			fatal("unable to create a thread: %s", strerror(errno));
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], 0);
+
+	pthread_mutex_destroy(&queue.lock);
+}
+
+static
+HChar* new_temp_file(void) {
+	Int fd;
+	HChar* name;
+
+	name = (HChar*) IGD_MALLOC("igd.merge.ntf.1", VG_(strlen)(tmpdir) + 32);
+	VG_(sprintf)(name, "%s/igd_merge.XXXXXX", tmpdir);
+
+	fd = mkstemp(name);
+	if (fd < 0)
+		fatal("unable to create a file in %s: %s", tmpdir, strerror(errno));
+	VG_(close)(fd);
+
+	if (temp_count == temp_max) {
+		temp_max = temp_max ? (temp_max * 2) : TEMPS_INITIAL;
+		temp_files = (HChar**) IGD_REALLOC("igd.merge.ntf.2", temp_files,
+								(temp_max * sizeof(HChar*)));
+	}
+	temp_files[temp_count++] = name;
+
+	return name;
+}
+
+// The names stay registered until the end.
+static
+void remove_temp_files(HChar** files, Int count) {
+	Int i;
+
+	for (i = 0; i < count; i++)
+		unlink(files[i]);
+
+	IGD_FREE(files);
+}
+
+// Merge the inputs in a tree: groups of at most MAX_FANIN files (or one
+// group per job at the first level) are merged to intermediate files
+// until they can be merged to the output at once.
+static
+void merge_tree(const HChar** inputs, Int ninputs, const HChar* outfile, Bool sort) {
+	Int i, groups, level, max;
+	HChar** temps;
+	HChar** files;
+	MergeTask* tasks;
+	MergeTask final;
+
+	temps = 0;
+	files = (HChar**) inputs;
+	for (level = 0; ; level++) {
+		groups = (ninputs + MAX_FANIN - 1) / MAX_FANIN;
+		if (level == 0 && jobs > groups) {
+			max = jobs < (ninputs / 2) ? jobs : (ninputs / 2);
+			if (max > groups)
+				groups = max;
+		}
+
+		if (groups <= 1)
+			break;
+
+		temps = (HChar**) IGD_MALLOC("igd.merge.mt.1", (groups * sizeof(HChar*)));
+		tasks = (MergeTask*) IGD_MALLOC("igd.merge.mt.2", (groups * sizeof(MergeTask)));
+		for (i = 0; i < groups; i++) {
+			Int start = (Int) (((Long) i * ninputs) / groups);
+			Int end = (Int) (((Long) (i + 1) * ninputs) / groups);
+
+			temps[i] = new_temp_file();
+
+			tasks[i].inputs = (const HChar**) files + start;
+			tasks[i].ninputs = end - start;
+			tasks[i].outfile = temps[i];
+			tasks[i].sort = sort;
+		}
+
+		run_tasks(tasks, groups);
+		IGD_FREE(tasks);
+
+		if (level > 0)
+			remove_temp_files(files, ninputs);
+
+		files = temps;
+		ninputs = groups;
+		sort = False;
+	}
+
+	final.inputs = (const HChar**) files;
+	final.ninputs = ninputs;
+	final.outfile = outfile;
+	final.sort = sort;
+	merge_files(&final);
+
+	if (level > 0)
+		remove_temp_files(files, ninputs);
+}
+
+int main(int argc, char* argv[]) {
+	Int c, i, fd;
+	Bool sort;
+	const HChar* outfile;
+
+	outfile = 0;
+	sort = False;
+	while ((c = getopt(argc, argv, "o:f:sj:T:")) != -1) {
+		switch (c) {
+			case 'o':
+				outfile = optarg;
+				break;
+			case 'f':
+				if (VG_(strcmp)(optarg, "text") == 0)
+					out_format = FMT_TEXT;
+				else if (VG_(strcmp)(optarg, "binary") == 0)
+					out_format = FMT_BINARY;
+				else
+					usage();
+				break;
+			case 's':
+				sort = True;
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				if (jobs < 1)
+					usage();
+				break;
+			case 'T':
+				tmpdir = optarg;
+				break;
+			default:
+				usage();
+		}
+	}
+
+	if (optind == argc)
+		usage();
+
+	if (!tmpdir && !(tmpdir = getenv("TMPDIR")))
+		tmpdir = "/tmp";
+
+	if (!outfile) {
+		// The count of a binary file is written at the end.
+		if (out_format == FMT_BINARY)
+			fatal("binary output needs a file (-o)");
+	} else {
+		fd = VG_(fd_open)(outfile, VKI_O_CREAT|VKI_O_WRONLY|VKI_O_TRUNC,
+							VKI_S_IRUSR|VKI_S_IWUSR);
+		if (fd < 0)
+			fatal("unable to create %s: %s", outfile, strerror(errno));
+		VG_(close)(fd);
+	}
+
+	for (i = optind; i < argc; i++)
+		scan_modules(argv[i]);
+
+	finish_modules(&modules);
+
+	if (out_format == FMT_BINARY)
+		check_binary_modules();
+
+	merge_tree((const HChar**) argv + optind, argc - optind, outfile, sort);
+
+	for (i = 0; i < temp_count; i++)
+		IGD_FREE(temp_files[i]);
+	IGD_FREE(temp_files);
+
+	delete_modules(&modules);
+
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+   ----------------------------------------------------------------
+
+   Notice that the following BSD-style license applies to this one
+   file (instrgrind.h) only.  The rest of instrgrind is licensed under
+   the terms of the GNU General Public License, version 2, unless
+   otherwise indicated.  See the COPYING file in the source
+   distribution for details.
+
+   ----------------------------------------------------------------
+
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions
+   are met:
+
+   1. Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+   2. The name of the author may not be used to endorse or promote
+      products derived from this software without specific prior written
+      permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS
+   OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+   ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+   DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+   GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+   INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+   NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+   SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+   ----------------------------------------------------------------
+
+   Notice that the above BSD-style license applies to this one file
+   (instrgrind.h) only.  The entire rest of instrgrind is licensed under
+   the terms of the GNU General Public License, version 2.  See the
+   COPYING file in the source distribution for details.
+
+   ----------------------------------------------------------------
+*/
+
+#ifndef __INSTRGRIND_H
+#define __INSTRGRIND_H
+
+#include "valgrind.h"
+
+/* Client requests of instrgrind, to control the counting from the
+   program under test. They do nothing when not running on instrgrind.
+
+   Only add new entries at the end, so the numbering of the old ones
+   stays the same for binaries already compiled. */
+typedef
+   enum {
+      VG_USERREQ__IGD_START_COUNTING = VG_USERREQ_TOOL_BASE('I','G'),
+      VG_USERREQ__IGD_STOP_COUNTING,
+      VG_USERREQ__IGD_ZERO_COUNTS,
+      VG_USERREQ__IGD_DUMP_COUNTS
+   } Vg_InstrgrindClientRequest;
+
+/* Start counting the executed instructions. The code is retranslated
+   with the counters. */
+#define INSTRGRIND_START_COUNTING                                 \
+  VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__IGD_START_COUNTING, \
+                                  0, 0, 0, 0, 0)
+
+/* Stop counting. The code is retranslated without any counter, so the
+   program runs as fast as under --tool=none until counting starts
+   again. */
+#define INSTRGRIND_STOP_COUNTING                                  \
+  VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__IGD_STOP_COUNTING,  \
+                                  0, 0, 0, 0, 0)
+
+/* Zero the execution counts of all instructions. */
+#define INSTRGRIND_ZERO_COUNTS                                    \
+  VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__IGD_ZERO_COUNTS,    \
+                                  0, 0, 0, 0, 0)
+
+/* Dump the execution counts to the file, or to the --instrs-outfile
+   file if it is NULL. */
+#define INSTRGRIND_DUMP_COUNTS(filename)                          \
+  VALGRIND_DO_CLIENT_REQUEST_STMT(VG_USERREQ__IGD_DUMP_COUNTS,    \
+                                  filename, 0, 0, 0, 0)
+
+#endif /* __INSTRGRIND_H */
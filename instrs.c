@@ -29,72 +29,123 @@
 #include "global.h"
 
 #define DEFAULT_POOL_SIZE 262144 // 256k instructions
+#define INSTRS_PER_SLAB 16384
+#define RADIX_SORT_MIN 4096 // Shorter arrays are sorted with VG_(ssort).
 
-struct {
-	enum {
-		TKN_COLON,
-		TKN_ADDR,
-		TKN_NUMBER
-	} type;
+AddrHash* instrs_pool = 0;
+Slab* instrs_slab = 0;
 
-	union {
-		Addr addr;
-		ULong number;
-	} data;
-
-	HChar text[1024];
-} token;
-
-SmartHash* instrs_pool = 0;
-
-static
-void delete_instr(UniqueInstr* instr) {
-	IGD_ASSERT(instr != 0);
-	IGD_DATA_FREE(instr, sizeof(UniqueInstr));
-}
+// Instructions of older code generations, replaced in the pool by
+// different code at the same address. They are kept to be dumped.
+SmartList* retired_instrs = 0;
 
 void IGD_(init_instrs_pool)() {
 	IGD_ASSERT(instrs_pool == 0);
+	IGD_ASSERT(instrs_slab == 0);
 
-	instrs_pool = IGD_(new_smart_hash)(DEFAULT_POOL_SIZE);
-
-	// set the growth rate to half the size.
-	IGD_(smart_hash_set_growth_rate)(instrs_pool, 1.5f);
+	instrs_pool = IGD_(new_addr_hash)(DEFAULT_POOL_SIZE);
+	instrs_slab = IGD_(new_slab)("igd.instrs.gi.1", sizeof(UniqueInstr), INSTRS_PER_SLAB);
+	retired_instrs = IGD_(new_smart_list)(64);
 }
 
 void IGD_(destroy_instrs_pool)() {
 	IGD_ASSERT(instrs_pool != 0);
+	IGD_ASSERT(instrs_slab != 0);
 
-	IGD_(smart_hash_clear)(instrs_pool, (void (*)(void*)) delete_instr);
-	IGD_(delete_smart_hash)(instrs_pool);
+	// The instructions are released all at once with the slab.
+	IGD_(addr_hash_clear)(instrs_pool, 0);
+	IGD_(delete_addr_hash)(instrs_pool);
 	instrs_pool = 0;
+
+	IGD_(smart_list_clear)(retired_instrs, 0);
+	IGD_(delete_smart_list)(retired_instrs);
+	retired_instrs = 0;
+
+	IGD_(delete_slab)(instrs_slab);
+	instrs_slab = 0;
+}
+
+static
+UniqueInstr* new_instr(Addr addr, Int size, UInt gen) {
+	UniqueInstr* instr;
+
+	instr = (UniqueInstr*) IGD_(slab_alloc)(instrs_slab);
+	VG_(memset)(instr, 0, sizeof(UniqueInstr));
+	instr->addr = addr;
+	instr->size = size;
+	instr->gen = gen;
+
+	return instr;
+}
+
+// An instruction of a generation older than the one in the pool, from a
+// lazy group (groups.c) flushed after its code was replaced. This is rare,
+// so the retired instructions are just scanned.
+static
+UniqueInstr* get_retired_instr(Addr addr, Int size, UInt gen) {
+	Int i, count;
+	UniqueInstr* instr;
+
+	count = IGD_(smart_list_count)(retired_instrs);
+	for (i = count - 1; i >= 0; i--) {
+		instr = (UniqueInstr*) IGD_(smart_list_at)(retired_instrs, i);
+		if (instr->addr == addr && instr->gen == gen && instr->size == size)
+			return instr;
+	}
+
+	instr = new_instr(addr, size, gen);
+	IGD_(smart_list_add)(retired_instrs, instr);
+
+	return instr;
 }
 
 UniqueInstr* IGD_(get_instr)(Addr addr, Int size) {
-	UniqueInstr* instr = IGD_(find_instr)(addr);
+	return IGD_(get_instr_gen)(addr, size, IGD_(code_generation)(addr));
+}
+
+// The instruction at the address in the generation of the code, which
+// is the current one unless it comes from a lazy group.
+UniqueInstr* IGD_(get_instr_gen)(Addr addr, Int size, UInt gen) {
+	UniqueInstr* instr;
+
+	instr = IGD_(find_instr)(addr);
 	if (instr) {
 		IGD_ASSERT(instr->addr == addr);
-		if (size != 0) {
-			if (instr->size == 0) {
-				instr->size = size;
-			} else {
-				IGD_ASSERT(instr->size == size);
-			}
+
+		if (instr->gen > gen)
+			return get_retired_instr(addr, size, gen);
+
+		// Code of a different size at the same address and generation was
+		// rewritten in place, so start a new generation for its page.
+		if (size != 0 && instr->size != 0 && instr->size != size && instr->gen == gen) {
+			IGD_(mark_code)(addr, size);
+			IGD_(bump_code_generation)(addr, 1);
+
+			gen = IGD_(code_generation)(addr);
+			IGD_ASSERT(instr->gen != gen);
 		}
-	} else {
-		instr = (UniqueInstr*) IGD_MALLOC("igd.instrs.gi.1", sizeof(UniqueInstr));
-		VG_(memset)(instr, 0, sizeof(UniqueInstr));
-		instr->addr = addr;
-		instr->size = size;
 
-		IGD_(smart_hash_put)(instrs_pool, instr, (HWord (*)(void*)) IGD_(instr_addr));
+		if (instr->gen != gen) {
+			// Keep the old code counts apart.
+			IGD_(addr_hash_remove)(instrs_pool, addr);
+			IGD_(smart_list_add)(retired_instrs, instr);
+
+			instr = 0;
+		} else if (size != 0 && instr->size == 0) {
+			instr->size = size;
+		}
+	}
+
+	if (!instr) {
+		instr = new_instr(addr, size, gen);
+		IGD_(addr_hash_put)(instrs_pool, addr, instr);
 	}
 
 	return instr;
 }
 
 UniqueInstr* IGD_(find_instr)(Addr addr) {
-	return (UniqueInstr*) IGD_(smart_hash_get)(instrs_pool, addr, (HWord (*)(void*)) IGD_(instr_addr));
+	return (UniqueInstr*) IGD_(addr_hash_get)(instrs_pool, addr);
 }
 
 Addr IGD_(instr_addr)(UniqueInstr* instr) {
@@ -108,7 +159,7 @@ Int IGD_(instr_size)(UniqueInstr* instr) {
 }
 
 Bool IGD_(instrs_cmp)(UniqueInstr* i1, UniqueInstr* i2) {
-	return i1 && i2 && i1->addr == i2->addr && i1->size == i2->size;
+	return i1 && i2 && i1->addr == i2->addr && i1->size == i2->size && i1->gen == i2->gen;
 }
 
 void IGD_(print_instr)(UniqueInstr* instr) {
@@ -123,165 +174,469 @@ void IGD_(fprint_instr)(VgFile* fp, UniqueInstr* instr) {
 	VG_(fprintf)(fp, "0x%lx [%d]", instr->addr, instr->size);
 }
 
+void IGD_(add_instr_count)(Addr addr, Int size, UInt gen, ULong count) {
+	UniqueInstr* instr;
+
+	IGD_ASSERT(size >= 0);
+
+	// Records of older generations are kept as they are.
+	if (gen != 0) {
+		instr = new_instr(addr, size, gen);
+		IGD_(smart_list_add)(retired_instrs, instr);
+	} else {
+		instr = IGD_(get_instr)(addr, size);
+		IGD_ASSERT(instr != 0);
+	}
+
+	instr->exec_count += count;
+}
+
+typedef struct {
+	Addr base;
+	SizeT size;
+	Int handle;
+} FileModule;
+
+static
+Int cmp_file_modules(const void* p1, const void* p2) {
+	const FileModule* m1 = (const FileModule*) p1;
+	const FileModule* m2 = (const FileModule*) p2;
+
+	return m1->base < m2->base ? -1 : (m1->base > m2->base ? 1 : 0);
+}
+
 static
-Bool next_token(Int fd) {
-	Int idx, state;
-	static Int last = -1;
+FileModule* find_file_module(FileModule* modules, Int count, Addr addr) {
+	Int lo, hi, mid;
+
+	lo = 0;
+	hi = count - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (addr < modules[mid].base)
+			hi = mid - 1;
+		else if (addr >= (modules[mid].base + modules[mid].size))
+			lo = mid + 1;
+		else
+			return &(modules[mid]);
+	}
 
-	idx = 0;
-	VG_(memset)(&token, 0, sizeof(token));
+	return 0;
+}
 
-	state = 1;
-	while (state != 6) {
-		Int c;
+static
+void read_binary_instrs(FileReader* fr) {
+	Int i, nmodules;
+	ULong n, nrecords;
+	Addr addr, last;
+	Int size;
+	UInt gen;
+	ULong count;
+	FileModule* modules;
+	FileModule* fm;
+
+	// The records in the modules are rebased onto this run (modules.c).
+	nmodules = IGD_(read_binary_header)(fr);
+	modules = (FileModule*) IGD_MALLOC("igd.instrs.rbi.1",
+					((nmodules + 1) * sizeof(FileModule)));
+	for (i = 0; i < nmodules; i++) {
+		HChar* name;
+
+		IGD_(read_binary_module)(fr, &name, &(modules[i].base), &(modules[i].size));
+		modules[i].handle = IGD_(add_input_module)(name, modules[i].base, modules[i].size);
+		IGD_FREE(name);
+	}
 
-		IGD_ASSERT(idx >= 0 && idx < ((sizeof(token.text) / sizeof(HChar))-1));
-		if (last == -1) {
-			Int s;
-			HChar tmp;
+	VG_(ssort)(modules, nmodules, sizeof(FileModule), cmp_file_modules);
 
-			s = VG_(read)(fd, &tmp, 1);
-			c = s < 1 ? -1 : tmp;
-		} else {
-			c = last;
-			last = -1;
+	last = 0;
+	nrecords = IGD_(read_binary_count)(fr);
+	for (n = 0; n < nrecords; n++) {
+		IGD_(read_binary_record)(fr, &last, &addr, &size, &gen, &count);
+
+		fm = find_file_module(modules, nmodules, addr);
+		if (fm)
+			IGD_(add_module_record)(fm->handle, addr - fm->base, size, gen, count);
+		else
+			IGD_(add_instr_count)(addr, size, gen, count);
+	}
+
+	IGD_FREE(modules);
+}
+
+static
+void read_text_instrs(FileReader* fr) {
+	Int id, module, size, nhandles;
+	Int* handles;
+	Addr addr;
+	SizeT msize;
+	UInt gen;
+	ULong count;
+	HChar* name;
+
+	nhandles = 16;
+	handles = (Int*) IGD_MALLOC("igd.instrs.rti.1", (nhandles * sizeof(Int)));
+	VG_(memset)(handles, 0xff, (nhandles * sizeof(Int)));
+
+	for (;;) {
+		if (IGD_(read_text_module)(fr, &id, &msize, &name)) {
+			IGD_ASSERT(id >= 0);
+
+			if (id >= nhandles) {
+				Int old = nhandles;
+
+				while (id >= nhandles)
+					nhandles *= 2;
+
+				handles = (Int*) IGD_REALLOC("igd.instrs.rti.2", handles,
+									(nhandles * sizeof(Int)));
+				VG_(memset)(handles + old, 0xff, ((nhandles - old) * sizeof(Int)));
+			}
+
+			// The text address of the modules is not recorded, so the
+			// records of the modules not loaded in this run could only
+			// be written back relative to them, in text.
+			if (IGD_(clo).instrs_format != FMT_TEXT)
+				VG_(fmsg_bad_option)("--instrs-infile",
+					"Module relative input needs text output\n");
+
+			handles[id] = IGD_(add_input_module)(name, 0, msize);
+			IGD_FREE(name);
+
+			continue;
 		}
 
-		switch (state) {
-			case 1:
-				if (c == -1) {
-					return False;
-				} else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
-					state = 1;
-				} else if (c == '0') {
-					token.text[idx++] = c;
-					token.type = TKN_NUMBER;
-					token.data.number = 0;
-					state = 2;
-				} else if (c >= '1' && c <= '9') {
-					token.text[idx++] = c;
-					token.type = TKN_NUMBER;
-					state = 4;
-				} else if (c == '#') {
-					state = 5;
-				} else if (c == ':') {
-					token.text[idx++] = c;
-					token.type = TKN_COLON;
-					state = 6;
-				} else {
-					tl_assert(0);
-				}
-
-				break;
-			case 2:
-				if (VG_(tolower)(c) == 'x') {
-					token.text[idx++] = VG_(tolower)(c);
-					token.type = TKN_ADDR;
-					state = 3;
-				} else {
-					if (c != -1)
-						last = c;
-
-					state = 6;
-				}
-
-				break;
-			case 3:
-				if ((c >= '0' && c <= '9') ||
-						(VG_(tolower)(c) >= 'a' && VG_(tolower)(c) <= 'f')) {
-					token.text[idx++] = VG_(tolower)(c);
-					state = 3;
-				} else {
-					token.data.addr = VG_(strtoull16)(token.text, 0);
-
-					if (c != -1)
-						last = c;
-
-					state = 6;
-				}
-
-				break;
-			case 4:
-				if (c >= '0' && c <= '9') {
-					token.text[idx++] = c;
-					state = 4;
-				} else {
-					token.data.number = VG_(strtoull10)(token.text, 0);
-
-					if (c != -1)
-						last = c;
-
-					state = 6;
-				}
-
-				break;
-			case 5:
-				if (c == -1 || c == '\n')
-					state = 1;
-				else
-					state = 5;
-
-				break;
-			default:
-				tl_assert(0);
+		if (!IGD_(read_text_record)(fr, &module, &addr, &size, &gen, &count))
+			break;
+
+		IGD_ASSERT(size > 0);
+
+		if (module >= 0) {
+			if (module >= nhandles || handles[module] < 0)
+				VG_(tool_panic)("instrgrind: undefined module in instructions file");
+
+			IGD_(add_module_record)(handles[module], addr, size, gen, count);
+		} else {
+			IGD_(add_instr_count)(addr, size, gen, count);
 		}
 	}
 
-	return True;
+	IGD_FREE(handles);
 }
 
-
 void IGD_(read_instrs)(Int fd) {
-	Addr addr;
-	Int size;
-	Bool has;
-	UniqueInstr* instr;
+	FileReader* fr;
 
-	while (next_token(fd)) {
-		IGD_ASSERT(token.type == TKN_ADDR);
-		addr = token.data.addr;
+	fr = IGD_(new_file_reader)(fd);
 
-		has = next_token(fd);
-		IGD_ASSERT(has && token.type == TKN_COLON);
+	if (IGD_(is_binary_file)(fr))
+		read_binary_instrs(fr);
+	else
+		read_text_instrs(fr);
 
-		has = next_token(fd);
-		IGD_ASSERT(has && token.type == TKN_NUMBER);
-		size = (Int) token.data.number;
-		IGD_ASSERT(size > 0);
+	IGD_(delete_file_reader)(fr);
 
-		instr = IGD_(get_instr)(addr, size);
-		IGD_ASSERT(instr != 0);
+	// Rebase the records of the modules already loaded.
+	IGD_(resolve_modules)();
+}
+
+// Number of instructions in the pool, including the older generations.
+Int IGD_(instrs_count)(void) {
+	return IGD_(addr_hash_count)(instrs_pool) + IGD_(smart_list_count)(retired_instrs);
+}
 
-		has = next_token(fd);
-		IGD_ASSERT(has && token.type == TKN_COLON);
+// Visit all the instructions, always in the same order if the pool is not
+// changed in between.
+void IGD_(forall_instrs)(Bool (*func)(UniqueInstr*, void*), void* arg) {
+	IGD_(addr_hash_forall)(instrs_pool, (Bool (*)(void*, void*)) func, arg);
+	IGD_(smart_list_forall)(retired_instrs, (Bool (*)(void*, void*)) func, arg);
+}
 
-		has = next_token(fd);
-		IGD_ASSERT(has && token.type == TKN_NUMBER);
-		instr->exec_count += token.data.number;
-	}
+static
+Bool zero_instr(UniqueInstr* instr, void* arg) {
+	instr->exec_count = 0;
+	return False;
 }
 
+void IGD_(zero_instrs)(void) {
+	IGD_(forall_instrs)(zero_instr, 0);
+}
+
+// Dump statistics (--stats=yes).
+static Int dumps_done = 0;
+static ULong dumped_records = 0;
+static ULong sort_time = 0;
+static ULong write_time = 0;
+
 static
-Bool dump_instr(UniqueInstr* instr, VgFile* outfile) {
+Bool collect_instr(UniqueInstr* instr, UniqueInstr*** next) {
 	IGD_ASSERT(instr != 0);
-	IGD_ASSERT(outfile != 0);
 
-	VG_(fprintf)(outfile, "0x%lx:%d:%llu\n", instr->addr, instr->size, instr->exec_count);
+	*((*next)++) = instr;
 
 	return False;
 }
 
-void IGD_(dump_instrs)(const HChar* filename) {
-	VgFile* outfile;
+Int IGD_(cmp_instrs_addr)(const void* p1, const void* p2) {
+	const UniqueInstr* i1 = *((const UniqueInstr* const*) p1);
+	const UniqueInstr* i2 = *((const UniqueInstr* const*) p2);
+
+	if (i1->addr != i2->addr)
+		return i1->addr < i2->addr ? -1 : 1;
+
+	return i1->gen < i2->gen ? -1 : (i1->gen > i2->gen ? 1 : 0);
+}
+
+// LSD radix sort by (address, generation), one byte per pass. The passes
+// of the bytes that are the same for all keys (the high bytes of the
+// addresses, the generations) are skipped, so a profile usually takes
+// three or four passes over the array.
+static
+void radix_sort_instrs(UniqueInstr** instrs, Int count) {
+	Int i, b, pass, npasses;
+	UInt* hist;
+	ULong key;
+	UniqueInstr** src;
+	UniqueInstr** dst;
+	UniqueInstr** tmp;
+
+	// The generation bytes go first, they are the least significant.
+	npasses = sizeof(UInt) + sizeof(Addr);
+	hist = (UInt*) IGD_MALLOC("igd.instrs.rsi.1", (npasses * 256 * sizeof(UInt)));
+	VG_(memset)(hist, 0, (npasses * 256 * sizeof(UInt)));
+
+	for (i = 0; i < count; i++) {
+		key = instrs[i]->gen;
+		for (pass = 0; pass < (Int) sizeof(UInt); pass++)
+			hist[(pass * 256) + ((key >> (pass * 8)) & 0xff)]++;
+
+		key = instrs[i]->addr;
+		for (; pass < npasses; pass++)
+			hist[(pass * 256) + ((key >> ((pass - sizeof(UInt)) * 8)) & 0xff)]++;
+	}
+
+	src = instrs;
+	dst = (UniqueInstr**) IGD_MALLOC("igd.instrs.rsi.2", (count * sizeof(UniqueInstr*)));
+	for (pass = 0; pass < npasses; pass++) {
+		UInt* h = hist + (pass * 256);
+		UInt sum, n;
+		Int shift;
+
+		// Skip the byte if all keys have the same.
+		for (b = 0; b < 256 && h[b] == 0; b++)
+			;
+		if (h[b] == (UInt) count)
+			continue;
+
+		sum = 0;
+		for (b = 0; b < 256; b++) {
+			n = h[b];
+			h[b] = sum;
+			sum += n;
+		}
+
+		if (pass < (Int) sizeof(UInt)) {
+			shift = pass * 8;
+			for (i = 0; i < count; i++)
+				dst[h[(src[i]->gen >> shift) & 0xff]++] = src[i];
+		} else {
+			shift = (pass - sizeof(UInt)) * 8;
+			for (i = 0; i < count; i++)
+				dst[h[(src[i]->addr >> shift) & 0xff]++] = src[i];
+		}
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	// An odd number of passes leaves the result in the other array.
+	if (src != instrs) {
+		VG_(memcpy)(instrs, src, (count * sizeof(UniqueInstr*)));
+		dst = src;
+	}
+
+	IGD_FREE(dst);
+	IGD_FREE(hist);
+}
+
+// Sort the instructions by address, in place.
+void IGD_(sort_instrs)(UniqueInstr** instrs, Int count) {
+	UInt start;
+
+	start = VG_(read_millisecond_timer)();
+
+	if (count < RADIX_SORT_MIN)
+		VG_(ssort)(instrs, count, sizeof(UniqueInstr*), IGD_(cmp_instrs_addr));
+	else
+		radix_sort_instrs(instrs, count);
+
+	sort_time += VG_(read_millisecond_timer)() - start;
+}
+
+// The modules of this run, and the pending input modules if npending.
+static
+void write_binary_modules(FileWriter* fw, Int npending) {
+	Int nmodules;
+	const DebugInfo* di;
+
+	nmodules = npending;
+	for (di = VG_(next_DebugInfo)(0); di; di = VG_(next_DebugInfo)(di)) {
+		if (VG_(DebugInfo_get_text_avma)(di))
+			nmodules++;
+	}
+
+	IGD_(write_binary_header)(fw, nmodules);
+	for (di = VG_(next_DebugInfo)(0); di; di = VG_(next_DebugInfo)(di)) {
+		Addr addr;
+
+		addr = VG_(DebugInfo_get_text_avma)(di);
+		if (!addr)
+			continue;
+
+		IGD_(write_binary_module)(fw, VG_(DebugInfo_get_filename)(di),
+			addr, VG_(DebugInfo_get_text_size)(di));
+	}
+
+	if (npending > 0)
+		IGD_(write_pending_binary_modules)(fw);
+}
+
+// Write the instructions, sorted by address, in the output format. With
+// text the pending records are written by module (see modules.c), if
+// requested; with binary these must be already in the array.
+static
+void write_instrs(const HChar* filename, UniqueInstr** instrs, Int count, Bool pending) {
+	Int i, npending;
+	UInt start;
+	Addr last;
+	FileWriter* fw;
+
+	start = VG_(read_millisecond_timer)();
+
+	npending = 0;
+	if (pending && !(IGD_(clo).instrs_format == FMT_TEXT && IGD_(clo).instrs_relative)) {
+		npending = IGD_(prepare_pending_modules)();
+
+		// The pending modules are kept at their old addresses.
+		if (IGD_(clo).instrs_format == FMT_BINARY && IGD_(pending_modules_overlap)())
+			VG_(fmsg_bad_option)("--instrs-format=binary",
+				"Modules of the input file not loaded overlap the modules of"
+				" this run, use --instrs-relative=yes text output\n");
+	}
+
+	fw = IGD_(new_file_writer)(filename);
 
-	outfile = VG_(fopen)(filename, VKI_O_WRONLY|VKI_O_TRUNC, 0);
-	if (outfile == 0) {
-		outfile = VG_(fopen)(filename, VKI_O_CREAT|VKI_O_WRONLY,
-										VKI_S_IRUSR|VKI_S_IWUSR);
+	if (IGD_(clo).instrs_format == FMT_BINARY) {
+		write_binary_modules(fw, npending);
+		IGD_(write_binary_count)(fw, count);
+
+		// The delta encoding requires the instructions sorted by address.
+		last = 0;
+		for (i = 0; i < count; i++)
+			IGD_(write_binary_record)(fw, &last, instrs[i]->addr, instrs[i]->size,
+				instrs[i]->gen, instrs[i]->exec_count);
+	} else if (IGD_(clo).instrs_relative) {
+		IGD_(write_text_modules)(fw);
+		IGD_(write_relative_records)(fw, instrs, count, pending);
+	} else {
+		if (npending > 0)
+			IGD_(write_pending_text_modules)(fw);
+
+		for (i = 0; i < count; i++)
+			IGD_(write_text_record)(fw, -1, instrs[i]->addr, instrs[i]->size,
+				instrs[i]->gen, instrs[i]->exec_count);
+
+		if (npending > 0)
+			IGD_(write_pending_text_records)(fw);
 	}
-	IGD_ASSERT(outfile != 0);
 
-	IGD_(smart_hash_forall)(instrs_pool, (Bool (*)(void*, void*)) dump_instr, outfile);
+	IGD_(delete_file_writer)(fw);
+
+	write_time += VG_(read_millisecond_timer)() - start;
+	dumped_records += count;
+	dumps_done++;
+}
+
+// All the instructions of the run, sorted by address. The array must be
+// freed by the caller.
+UniqueInstr** IGD_(sorted_instrs)(Int* count) {
+	UniqueInstr** instrs;
+	UniqueInstr** next;
+
+	*count = IGD_(instrs_count)();
+	instrs = (UniqueInstr**) IGD_MALLOC("igd.instrs.si.1",
+						((*count + 1) * sizeof(UniqueInstr*)));
+	next = instrs;
+	IGD_(forall_instrs)((Bool (*)(UniqueInstr*, void*)) collect_instr, &next);
+	IGD_ASSERT((next - instrs) == *count);
+
+	IGD_(sort_instrs)(instrs, *count);
+
+	return instrs;
+}
+
+// The pending records are the input counts of modules not loaded yet.
+// They are written with the others, in the same order.
+static
+void dump_instrs_file(const HChar* filename, Bool pending) {
+	Int count;
+	Bool absolute;
+	UniqueInstr** instrs;
+	UniqueInstr** next;
+
+	// Only binary has the pending records with absolute addresses, text
+	// writes them by module.
+	absolute = IGD_(clo).instrs_format == FMT_BINARY;
+
+	count = IGD_(instrs_count)();
+	if (pending && absolute)
+		count += IGD_(pending_count)();
+
+	instrs = (UniqueInstr**) IGD_MALLOC("igd.instrs.dif.1",
+						((count + 1) * sizeof(UniqueInstr*)));
+	next = instrs;
+	IGD_(forall_instrs)((Bool (*)(UniqueInstr*, void*)) collect_instr, &next);
+	if (pending && absolute)
+		IGD_(collect_pending)(&next);
+	IGD_ASSERT((next - instrs) == count);
+
+	IGD_(sort_instrs)(instrs, count);
+	write_instrs(filename, instrs, count, pending);
+
+	IGD_FREE(instrs);
+}
+
+void IGD_(dump_instrs)(const HChar* filename) {
+	dump_instrs_file(filename, True);
+}
+
+// Dump only the instructions seen in this run.
+void IGD_(dump_run_instrs)(const HChar* filename) {
+	dump_instrs_file(filename, False);
+}
+
+// Dump only the given instructions (that may be copies with other
+// counts), in the same format of IGD_(dump_instrs). The array is sorted
+// in place.
+void IGD_(dump_instrs_list)(const HChar* filename, UniqueInstr** instrs, Int count) {
+	IGD_(sort_instrs)(instrs, count);
+	write_instrs(filename, instrs, count, False);
+}
+
+void IGD_(print_dump_stats)(void) {
+	VG_(dmsg)("dumps: %'d files, %'llu records, sorted in %'llu ms,"
+		" written in %'llu ms\n", dumps_done, dumped_records, sort_time, write_time);
+}
+
+void IGD_(print_instrs_stats)(void) {
+	Int count;
+
+	IGD_ASSERT(instrs_slab != 0);
 
-	VG_(fclose)(outfile);
+	count = IGD_(slab_count)(instrs_slab);
+	VG_(dmsg)("instrs: %'d unique instructions (%'d of older generations),"
+		" %'lu bytes in slabs (%'lu bytes as separate blocks)\n", count,
+		IGD_(smart_list_count)(retired_instrs), IGD_(slab_bytes)(instrs_slab),
+		count * (sizeof(UniqueInstr) + IGD_MALLOC_OVERHEAD));
 }
@@ -27,13 +27,18 @@
 */
 
 #include "global.h"
+#include "instrgrind.h"
 
-struct {
-	const HChar* instrs_infile;
-	Bool ignore_failed;
-	const HChar* instrs_outfile;
-	const HChar* mappings_outfile;
-} IGD_(clo);
+#include "pub_tool_transtab.h"
+
+CommandLineOptions IGD_(clo);
+
+// Whether the code is being instrumented with counters.
+static Bool counting = True;
+
+// Whether the guarded counters (--counter-mode=guarded) are incremented,
+// loaded by the instrumented code.
+static UInt counters_enabled = 1;
 
 #if defined(VG_BIGENDIAN)
 #define IGD_Endness Iend_BE
@@ -43,64 +48,313 @@ struct {
 #error "Unknown endianness"
 #endif
 
-#if INSTR_INC_MODE == 1
-  #define USING_INSTR_CALLBACK
-#elif INSTR_INC_MODE == 2
-  #define USING_INSTR_EXPR
-#else
-  #error "Invalid instruction increment mode"
-#endif
+static VG_REGPARM(1)
+void IGD_(count_thread_group)(InstrGroup* group) {
+	++IGD_(current_counters)[group->id];
+}
 
-#if defined(USING_INSTR_CALLBACK)
 static VG_REGPARM(1)
-void IGD_(count_group)(InstrGroup* group) {
-	++group->exec_count;
+void IGD_(count_counter)(ULong* counter) {
+	++(*counter);
+}
+
+static VG_REGPARM(2)
+void IGD_(count_counter32)(UInt* counter, UInt id) {
+	if (++(*counter) == 0)
+		IGD_(spill_counter)(id);
+}
+
+// The guard, if not null, is the condition of a side exit: the call is
+// only done when the exit is taken.
+static
+void IGD_(add_increment_callback)(IRSB* sbOut, InstrGroup* group, IRExpr* guard) {
+	IRDirty* di;
+
+	if (IGD_(clo).separate_threads) {
+		di = unsafeIRDirty_0_N(1, "count_thread_group",
+						VG_(fnptr_to_fnentry)(IGD_(count_thread_group)),
+						mkIRExprVec_1(mkIRExpr_HWord((HWord) group)));
+	} else if (IGD_(clo).counter_width == 32) {
+		di = unsafeIRDirty_0_N(2, "count_counter32",
+						VG_(fnptr_to_fnentry)(IGD_(count_counter32)),
+						mkIRExprVec_2(mkIRExpr_HWord((HWord) IGD_(counter_addr)(group->id)),
+							mkIRExpr_HWord((HWord) group->id)));
+	} else {
+		di = unsafeIRDirty_0_N(1, "count_counter",
+						VG_(fnptr_to_fnentry)(IGD_(count_counter)),
+						mkIRExprVec_1(mkIRExpr_HWord((HWord) IGD_(counter_addr)(group->id))));
+	}
+
+	if (guard)
+		di->guard = guard;
+
+	addStmtToIRSB(sbOut, IRStmt_Dirty(di));
 }
 
 static
-void IGD_(add_increment_callback)(IRSB* sbOut, InstrGroup* group) {
-	addStmtToIRSB(sbOut, IRStmt_Dirty(unsafeIRDirty_0_N(1, "count_group",
-					VG_(fnptr_to_fnentry)(IGD_(count_group)),
-					mkIRExprVec_1(mkIRExpr_HWord((HWord) group)))));
+IRExpr* IGD_(word_const)(IRType tyW, HWord value) {
+	return tyW == Ity_I32 ? IRExpr_Const(IRConst_U32((UInt) value)) :
+				IRExpr_Const(IRConst_U64((ULong) value));
 }
-#elif defined(USING_INSTR_EXPR)
+
+// Increment the counter of type tyC at the address ptrValue, an IR atom,
+// and return the temporary with the new value. If guard is not null, the
+// counter is only loaded and stored when it is true (the value is 1 when
+// it is false).
 static
-void IGD_(add_increment_expr)(IRSB* sbOut, IRType tyW, ULong* ptr) {
+IRTemp IGD_(add_increment_at)(IRSB* sbOut, IRType tyC, IRExpr* ptrValue, IRExpr* guard) {
 	IROp addOp;
 	IRTemp v1, v2;
-	IRExpr* ptrValue;
 	IRExpr* oneValue;
 	IRExpr* memValue;
 	IRExpr* incValue;
 
-	if (tyW == Ity_I32) {
-		addOp = Iop_Add32;
-		ptrValue = IRExpr_Const(IRConst_U32((HWord) ptr));
-		oneValue =  IRExpr_Const(IRConst_U32(1));
+	addOp = tyC == Ity_I32 ? Iop_Add32 : Iop_Add64;
+	oneValue = IGD_(word_const)(tyC, 1);
+
+	v1 = newIRTemp(sbOut->tyenv, tyC);
+	if (guard) {
+		addStmtToIRSB(sbOut, IRStmt_LoadG(IGD_Endness,
+			tyC == Ity_I32 ? ILGop_Ident32 : ILGop_Ident64, v1, ptrValue,
+			IGD_(word_const)(tyC, 0), guard));
 	} else {
-		addOp = Iop_Add64;
-		ptrValue = IRExpr_Const(IRConst_U64((HWord) ptr));
-		oneValue = IRExpr_Const(IRConst_U64(1));
+		memValue = IRExpr_Load(IGD_Endness, tyC, ptrValue);
+		addStmtToIRSB(sbOut, IRStmt_WrTmp(v1, memValue));
 	}
 
-	v1 = newIRTemp(sbOut->tyenv, tyW);
-	memValue = IRExpr_Load(IGD_Endness, tyW, ptrValue);
-	addStmtToIRSB(sbOut, IRStmt_WrTmp(v1, memValue));
-
-	v2 = newIRTemp(sbOut->tyenv, tyW);
+	v2 = newIRTemp(sbOut->tyenv, tyC);
 	incValue = IRExpr_Binop(addOp, IRExpr_RdTmp(v1), oneValue);
 	addStmtToIRSB(sbOut, IRStmt_WrTmp(v2, incValue));
 
-	addStmtToIRSB(sbOut, IRStmt_Store(IGD_Endness, ptrValue, IRExpr_RdTmp(v2)));
+	if (guard)
+		addStmtToIRSB(sbOut, IRStmt_StoreG(IGD_Endness, ptrValue, IRExpr_RdTmp(v2), guard));
+	else
+		addStmtToIRSB(sbOut, IRStmt_Store(IGD_Endness, ptrValue, IRExpr_RdTmp(v2)));
+
+	return v2;
+}
+
+static
+void IGD_(add_increment_expr)(IRSB* sbOut, IRType tyW, ULong* ptr, IRExpr* guard) {
+	IGD_(add_increment_at)(sbOut, tyW, IGD_(word_const)(tyW, (HWord) ptr), guard);
+}
+
+// Increment the 32 bit counter of the group id, spilling it to the
+// overflow array when it wraps (counters.c).
+static
+void IGD_(add_increment32_expr)(IRSB* sbOut, IRType tyW, UInt id, IRExpr* guard) {
+	IRTemp value, wrapped;
+	IRDirty* di;
+
+	value = IGD_(add_increment_at)(sbOut, Ity_I32,
+		IGD_(word_const)(tyW, (HWord) IGD_(counter_addr)(id)), guard);
+
+	wrapped = newIRTemp(sbOut->tyenv, Ity_I1);
+	addStmtToIRSB(sbOut, IRStmt_WrTmp(wrapped, IRExpr_Binop(Iop_CmpEQ32,
+		IRExpr_RdTmp(value), IRExpr_Const(IRConst_U32(0)))));
+
+	di = unsafeIRDirty_0_N(1, "spill_counter",
+					VG_(fnptr_to_fnentry)(IGD_(spill_counter)),
+					mkIRExprVec_1(mkIRExpr_HWord((HWord) id)));
+	di->guard = IRExpr_RdTmp(wrapped);
+	addStmtToIRSB(sbOut, IRStmt_Dirty(di));
+}
+
+// Increment the group slot in the counters of the running thread. The
+// array is loaded on every execution since it moves when it grows.
+static
+void IGD_(add_thread_increment_expr)(IRSB* sbOut, IRType tyW, UInt id, IRExpr* guard) {
+	IRTemp base, ptr;
+
+	base = newIRTemp(sbOut->tyenv, tyW);
+	addStmtToIRSB(sbOut, IRStmt_WrTmp(base, IRExpr_Load(IGD_Endness, tyW,
+		IGD_(word_const)(tyW, (HWord) &IGD_(current_counters)))));
+
+	ptr = newIRTemp(sbOut->tyenv, tyW);
+	addStmtToIRSB(sbOut, IRStmt_WrTmp(ptr, IRExpr_Binop(
+		tyW == Ity_I32 ? Iop_Add32 : Iop_Add64, IRExpr_RdTmp(base),
+		IGD_(word_const)(tyW, (HWord) id * sizeof(ULong)))));
+
+	IGD_(add_increment_at)(sbOut, tyW, IRExpr_RdTmp(ptr), guard);
+}
+
+// The guard of the increments with --counter-mode=guarded: the counters
+// are only incremented while counters_enabled is set, combined with the
+// guard of the side exit, if not null.
+static
+IRExpr* IGD_(counter_guard)(IRSB* sbOut, IRType tyW, IRExpr* guard) {
+	IRTemp flag, enabled, both;
+
+	if (IGD_(clo).counter_mode != CNT_GUARDED)
+		return guard;
+
+	flag = newIRTemp(sbOut->tyenv, Ity_I32);
+	addStmtToIRSB(sbOut, IRStmt_WrTmp(flag, IRExpr_Load(IGD_Endness, Ity_I32,
+		IGD_(word_const)(tyW, (HWord) &counters_enabled))));
+
+	enabled = newIRTemp(sbOut->tyenv, Ity_I1);
+	addStmtToIRSB(sbOut, IRStmt_WrTmp(enabled, IRExpr_Binop(Iop_CmpNE32,
+		IRExpr_RdTmp(flag), IRExpr_Const(IRConst_U32(0)))));
+
+	if (!guard)
+		return IRExpr_RdTmp(enabled);
+
+	both = newIRTemp(sbOut->tyenv, Ity_I1);
+	addStmtToIRSB(sbOut, IRStmt_WrTmp(both, IRExpr_Binop(Iop_And1,
+		guard, IRExpr_RdTmp(enabled))));
+
+	return IRExpr_RdTmp(both);
+}
+
+static
+void IGD_(add_counter_increment)(IRSB* sbOut, IRType tyW, ULong* counter, IRExpr* guard) {
+	IRDirty* di;
+
+	if (IGD_(clo).counter_mode == CNT_CALL) {
+		di = unsafeIRDirty_0_N(1, "count_counter",
+						VG_(fnptr_to_fnentry)(IGD_(count_counter)),
+						mkIRExprVec_1(mkIRExpr_HWord((HWord) counter)));
+		if (guard)
+			di->guard = guard;
+
+		addStmtToIRSB(sbOut, IRStmt_Dirty(di));
+	} else {
+		IGD_(add_increment_expr)(sbOut, tyW, counter,
+			IGD_(counter_guard)(sbOut, tyW, guard));
+	}
+}
+
+static
+void IGD_(add_group_increment)(IRSB* sbOut, IRType tyW, InstrGroup* group, IRExpr* guard) {
+	if (IGD_(clo).counter_mode == CNT_CALL) {
+		IGD_(add_increment_callback)(sbOut, group, guard);
+		return;
+	}
+
+	guard = IGD_(counter_guard)(sbOut, tyW, guard);
+
+	if (IGD_(clo).separate_threads)
+		IGD_(add_thread_increment_expr)(sbOut, tyW, group->id, guard);
+	else if (IGD_(clo).counter_width == 32)
+		IGD_(add_increment32_expr)(sbOut, tyW, group->id, guard);
+	else
+		IGD_(add_increment_expr)(sbOut, tyW, (ULong*) IGD_(counter_addr)(group->id), guard);
+}
+
+// The exits counted as edges: branches, calls, returns and jumps.
+static
+Bool IGD_(is_edge_jump)(IRJumpKind jk) {
+	return jk == Ijk_Boring || jk == Ijk_Call || jk == Ijk_Ret;
+}
+
+static
+Addr IGD_(const_addr)(const IRConst* con) {
+	switch (con->tag) {
+		case Ico_U32:
+			return (Addr) con->Ico.U32;
+		case Ico_U64:
+			return (Addr) con->Ico.U64;
+		default:
+			VG_(tool_panic)("instrgrind: unexpected exit address type");
+	}
+}
+
+// Whether the exit of an instruction jumps, that is it does not just go
+// to the next instruction: the fall through of a conditional branch, or
+// the end of a superblock cut by VEX after any instruction.
+static
+Bool IGD_(is_jump_exit)(IRStmt* imark, IRExpr* dst) {
+	Addr next;
+
+	if (dst->tag != Iex_Const)
+		return True;
+
+	next = imark->Ist.IMark.addr + imark->Ist.IMark.len;
+	return IGD_(const_addr)(dst->Iex.Const.con) != next + imark->Ist.IMark.delta;
+}
+
+// The instruction of the exits, also created for lazy groups.
+static
+UniqueInstr* IGD_(imark_instr)(IRStmt* imark) {
+	return IGD_(get_instr)(imark->Ist.IMark.addr, imark->Ist.IMark.len);
+}
+
+// Count the edge from the instruction to the destination, when the guard
+// (if not null) is true. The counter of a constant destination is taken
+// now, the computed ones are searched at run time.
+static
+void IGD_(add_edge_count)(IRSB* sbOut, IRType tyW, UniqueInstr* src, IRExpr* dst, IRExpr* guard) {
+	EdgeSite* site;
+	IRDirty* di;
+
+	site = IGD_(edge_site)(src);
+	if (dst->tag == Iex_Const) {
+		IGD_(add_counter_increment)(sbOut, tyW,
+			IGD_(edge_counter)(site, IGD_(const_addr)(dst->Iex.Const.con)), guard);
+	} else {
+		di = unsafeIRDirty_0_N(2, "count_edge",
+						VG_(fnptr_to_fnentry)(IGD_(count_edge)),
+						mkIRExprVec_2(mkIRExpr_HWord((HWord) site), dst));
+
+		guard = IGD_(counter_guard)(sbOut, tyW, guard);
+		if (guard)
+			di->guard = guard;
+
+		addStmtToIRSB(sbOut, IRStmt_Dirty(di));
+	}
+}
+
+// Register the superblock in the touched list the first time it runs
+// after a snapshot, so only the executed ones are flushed.
+static
+void IGD_(add_touch_check)(IRSB* sbOut, InstrBlock* block) {
+	IRTemp touched, untouched;
+	IRDirty* di;
+
+	touched = newIRTemp(sbOut->tyenv, Ity_I32);
+	addStmtToIRSB(sbOut, IRStmt_WrTmp(touched, IRExpr_Load(IGD_Endness, Ity_I32,
+		mkIRExpr_HWord((HWord) &(block->touched)))));
+
+	untouched = newIRTemp(sbOut->tyenv, Ity_I1);
+	addStmtToIRSB(sbOut, IRStmt_WrTmp(untouched, IRExpr_Binop(Iop_CmpEQ32,
+		IRExpr_RdTmp(touched), IRExpr_Const(IRConst_U32(0)))));
+
+	di = unsafeIRDirty_0_N(1, "touch_block",
+					VG_(fnptr_to_fnentry)(IGD_(touch_block)),
+					mkIRExprVec_1(mkIRExpr_HWord((HWord) block)));
+	di->guard = IRExpr_RdTmp(untouched);
+	addStmtToIRSB(sbOut, IRStmt_Dirty(di));
 }
-#endif
 
 static
 void IGD_(clo_set_defaults)(void) {
 	IGD_(clo).instrs_infile = 0;
 	IGD_(clo).ignore_failed = False;
 	IGD_(clo).instrs_outfile = 0;
+	IGD_(clo).instrs_format = FMT_TEXT;
+	IGD_(clo).instrs_relative = False;
 	IGD_(clo).mappings_outfile = 0;
+	IGD_(clo).groups_outfile = 0;
+	IGD_(clo).funcs_outfile = 0;
+	IGD_(clo).objs_outfile = 0;
+	IGD_(clo).edges_outfile = 0;
+	IGD_(clo).summary = False;
+	IGD_(clo).summary_outfile = 0;
+	IGD_(clo).summary_top = 20;
+	IGD_(clo).separate_threads = False;
+	IGD_(clo).exit_counters = False;
+	IGD_(clo).counter_width = 64;
+	IGD_(clo).counter_mode = CNT_INLINE;
+	IGD_(clo).lazy_instrs = False;
+	IGD_(clo).dump_every_bb = 0;
+	IGD_(clo).dump_interval = 0;
+	IGD_(clo).dump_incremental = False;
+	IGD_(clo).collect_atstart = True;
+	IGD_(clo).include_objs = 0;
+	IGD_(clo).exclude_objs = 0;
+	IGD_(clo).include_range = 0;
+	IGD_(clo).sample_period = 0;
+	IGD_(clo).sample_window = 100000;
 }
 
 static
@@ -110,7 +364,35 @@ Bool IGD_(process_cmd_line_option)(const HChar* arg) {
 	else if VG_BOOL_CLO(arg, "--ignore-failed-instrs", IGD_(clo).ignore_failed) {}
 
 	else if VG_STR_CLO(arg, "--instrs-outfile", IGD_(clo).instrs_outfile) {}
+	else if VG_XACT_CLO(arg, "--instrs-format=text", IGD_(clo).instrs_format, FMT_TEXT) {}
+	else if VG_XACT_CLO(arg, "--instrs-format=binary", IGD_(clo).instrs_format, FMT_BINARY) {}
+	else if VG_BOOL_CLO(arg, "--instrs-relative", IGD_(clo).instrs_relative) {}
 	else if VG_STR_CLO(arg, "--mappings-outfile", IGD_(clo).mappings_outfile) {}
+	else if VG_STR_CLO(arg, "--groups-outfile", IGD_(clo).groups_outfile) {}
+	else if VG_STR_CLO(arg, "--funcs-outfile", IGD_(clo).funcs_outfile) {}
+	else if VG_STR_CLO(arg, "--objs-outfile", IGD_(clo).objs_outfile) {}
+	else if VG_STR_CLO(arg, "--edges-outfile", IGD_(clo).edges_outfile) {}
+	else if VG_BOOL_CLO(arg, "--summary", IGD_(clo).summary) {}
+	else if VG_STR_CLO(arg, "--summary-outfile", IGD_(clo).summary_outfile) {}
+	else if VG_BINT_CLO(arg, "--summary-top", IGD_(clo).summary_top, 0, 1000000) {}
+	else if VG_BOOL_CLO(arg, "--separate-threads", IGD_(clo).separate_threads) {}
+	else if VG_BOOL_CLO(arg, "--exit-counters", IGD_(clo).exit_counters) {}
+	else if VG_XACT_CLO(arg, "--counter-width=64", IGD_(clo).counter_width, 64) {}
+	else if VG_XACT_CLO(arg, "--counter-width=32", IGD_(clo).counter_width, 32) {}
+	else if VG_XACT_CLO(arg, "--counter-mode=inline", IGD_(clo).counter_mode, CNT_INLINE) {}
+	else if VG_XACT_CLO(arg, "--counter-mode=call", IGD_(clo).counter_mode, CNT_CALL) {}
+	else if VG_XACT_CLO(arg, "--counter-mode=guarded", IGD_(clo).counter_mode, CNT_GUARDED) {}
+	else if VG_BOOL_CLO(arg, "--lazy-instrs", IGD_(clo).lazy_instrs) {}
+	else if VG_BINT_CLO(arg, "--dump-every-bb", IGD_(clo).dump_every_bb, 0, (Long) 1e15) {}
+	else if VG_BINT_CLO(arg, "--dump-interval", IGD_(clo).dump_interval, 0, 86400000) {}
+	else if VG_XACT_CLO(arg, "--dump-mode=cumulative", IGD_(clo).dump_incremental, False) {}
+	else if VG_XACT_CLO(arg, "--dump-mode=incremental", IGD_(clo).dump_incremental, True) {}
+	else if VG_BOOL_CLO(arg, "--collect-atstart", IGD_(clo).collect_atstart) {}
+	else if VG_STR_CLO(arg, "--include-objs", IGD_(clo).include_objs) {}
+	else if VG_STR_CLO(arg, "--exclude-objs", IGD_(clo).exclude_objs) {}
+	else if VG_STR_CLO(arg, "--include-range", IGD_(clo).include_range) {}
+	else if VG_BINT_CLO(arg, "--sample-period", IGD_(clo).sample_period, 0, (Long) 1e15) {}
+	else if VG_BINT_CLO(arg, "--sample-window", IGD_(clo).sample_window, 1, (Long) 1e15) {}
 	else
 		return False;
 
@@ -124,7 +406,43 @@ void IGD_(print_usage)(void) {
 "    --instrs-infile=<f>             Input file with instructions execution count\n"
 "    --ignore-failed-instrs=no|yes   Ignore failed instrunctions input file read [no]\n"
 "    --instrs-outfile=<f>            Output file with instructions execution count\n"
+"                                    (%%p is replaced by the pid, %%q{VAR} by $VAR)\n"
+"    --instrs-format=text|binary     Format of the instructions output file [text]\n"
+"    --instrs-relative=no|yes        Text addresses relative to their modules [no]\n"
 "    --mappings-outfile=<f>          Output file with memory mappings (bin, libs, ...)\n"
+"    --groups-outfile=<f>            Output file with the counts per group of instructions\n"
+"    --funcs-outfile=<f>             Output file with the counts per function\n"
+"    --objs-outfile=<f>              Output file with the counts per object\n"
+"    --edges-outfile=<f>             Output file with the taken exits (control flow edges)\n"
+"    --summary=no|yes                Print a summary of the counts at exit [no]\n"
+"    --summary-outfile=<f>           Write the summary to a file instead\n"
+"    --summary-top=<n>               Hottest instructions and functions listed [20]\n"
+"    --separate-threads=no|yes       Count per thread, also dumping <f>-<tid> files [no]\n"
+"    --exit-counters=no|yes          Count superblock entries and taken exits only [no]\n"
+"    --counter-width=64|32           Bits of the group counters; 32 bit ones spill\n"
+"                                    into 64 bit overflow counters when they wrap [64]\n"
+"    --counter-mode=inline|call|guarded  Increment the counters inline, by calling\n"
+"                                    a helper, or inline only while counting, so\n"
+"                                    the code is not retranslated when counting\n"
+"                                    stops or starts [inline]\n"
+"    --lazy-instrs=no|yes            Create the instructions of the groups when they\n"
+"                                    are flushed with a count, not translated [no]\n"
+"    --dump-every-bb=<count>         Dump a snapshot every <count> superblocks [0=never]\n"
+"    --dump-interval=<ms>            Dump a snapshot every <ms> milliseconds [0=never]\n"
+"    --dump-mode=cumulative|incremental  Counts since the start or since the last\n"
+"                                    snapshot [cumulative]\n"
+"    --collect-atstart=no|yes        Count from the start, or only after a client\n"
+"                                    request starts counting [yes]\n"
+"    --include-objs=<p1,p2,...>      Count only the code of the matching objects\n"
+"                                    (file or base name patterns, with * and ?)\n"
+"    --exclude-objs=<p1,p2,...>      Do not count the code of the matching objects\n"
+"    --include-range=<s-e,...>       Count only the code in the hex address ranges\n"
+"    --sample-period=<count>         Count only a window of every <count> superblocks,\n"
+"                                    scaling the counts at exit [0=count all]\n"
+"    --sample-window=<count>         Superblocks counted in each period [100000];\n"
+"                                    the windows change only at thread switches,\n"
+"                                    so they last about a scheduling quantum\n"
+"                                    (100000 superblocks) at least\n"
 	);
 }
 
@@ -135,10 +453,44 @@ void IGD_(print_debug_usage)(void) {
    );
 }
 
+// Whether the code runs with counters: while counting and in the sampling
+// windows, if sampled.
+static
+Bool IGD_(counters_active)(void) {
+	return counting && (!IGD_(sampling_enabled)() || IGD_(sampling_window)());
+}
+
 static
 void IGD_(post_clo_init)(void) {
+	if (IGD_(filters_enabled)())
+		IGD_(init_filters)();
+
+	IGD_(init_pages_pool)();
+	IGD_(init_modules)();
 	IGD_(init_instrs_pool)();
+	IGD_(init_counters)();
 	IGD_(init_groups_pool)();
+	IGD_(init_blocks_pool)();
+	IGD_(init_aggregates)();
+
+	// The jumps chased by VEX have no exit in the superblock, so they
+	// could not be counted as edges.
+	if (IGD_(clo).edges_outfile) {
+		VG_(clo_vex_control).guest_chase = False;
+		IGD_(init_edges)();
+	}
+
+	if (IGD_(clo).separate_threads)
+		IGD_(init_threads)();
+
+	if (IGD_(snapshots_enabled)())
+		IGD_(init_snapshots)();
+
+	if (IGD_(sampling_enabled)())
+		IGD_(init_sampling)();
+
+	counting = IGD_(clo).collect_atstart;
+	counters_enabled = IGD_(counters_active)();
 
 	// read the instructions from file if option is present.
 	if (IGD_(clo).instrs_infile) {
@@ -156,16 +508,32 @@ static
 IRSB* IGD_(instrument)(VgCallbackClosure* closure, IRSB* sbIn,
          const VexGuestLayout* layout,  const VexGuestExtents* vge,
          const VexArchInfo* archinfo_host, IRType gWordTy, IRType hWordTy) {
-	Int i;
-	UniqueInstr* instr;
+	Int i, last;
+	Bool marked;
 	InstrGroup* group;
+	InstrGroup* exit_group;
+	InstrBlock* block;
 	IRSB* sbOut;
 	IRStmt* st;
+	IRStmt* imark;
 
 	// We don't currently support this case
 	if (gWordTy != hWordTy)
 		VG_(tool_panic)("host/guest word size mismatch");
 
+	// Every translation is registered, with counters or not, since their
+	// discards are not told apart (blocks.c).
+	block = IGD_(new_block)(vge->base[0]);
+
+	// Run the code as it is while not counting, or out of the sampling
+	// windows. The guarded counters are switched off instead.
+	if (IGD_(clo).counter_mode != CNT_GUARDED && !IGD_(counters_active)())
+		return sbIn;
+
+	// Also the code filtered out by --include-objs/--exclude-objs/--include-range.
+	if (IGD_(filters_enabled)() && !IGD_(filter_block)(vge->base[0]))
+		return sbIn;
+
 	// Set up SB
 	sbOut = deepCopyIRSBExceptStmts(sbIn);
 
@@ -176,41 +544,239 @@ IRSB* IGD_(instrument)(VgCallbackClosure* closure, IRSB* sbIn,
 		i++;
 	}
 
+	// The last instruction, no exit after it has a group.
+	last = sbIn->stmts_used - 1;
+	while (last >= i && (!sbIn->stmts[last] || sbIn->stmts[last]->tag != Ist_IMark))
+		last--;
+
 	// Copy instructions to new superblock
+	marked = False;
 	group = 0;
+	exit_group = 0;
+	imark = 0;
 	for (/*use current i*/; i < sbIn->stmts_used; i++) {
 		st = sbIn->stmts[i];
 		if (!st || st->tag == Ist_NoOp)
 			continue;
 
+		// Count the exit when it is taken, in the group of the
+		// instructions that follow it, started at the next IMark. The
+		// exits with no instruction between them share the group.
+		if (st->tag == Ist_Exit && IGD_(clo).exit_counters && group != 0 && i < last) {
+			if (exit_group == 0) {
+				exit_group = IGD_(new_group)();
+				IGD_(block_add_group)(block, exit_group);
+			}
+
+			IGD_(add_group_increment)(sbOut, hWordTy, exit_group, st->Ist.Exit.guard);
+		}
+
+		if (st->tag == Ist_Exit && IGD_(clo).edges_outfile && imark != 0 &&
+				IGD_(is_edge_jump)(st->Ist.Exit.jk) &&
+				IGD_(is_jump_exit)(imark, IRExpr_Const(st->Ist.Exit.dst)))
+			IGD_(add_edge_count)(sbOut, hWordTy, IGD_(imark_instr)(imark),
+				IRExpr_Const(st->Ist.Exit.dst), st->Ist.Exit.guard);
+
 		addStmtToIRSB(sbOut, st);
 
 		switch (st->tag) {
 			case Ist_IMark:
-				if (group == 0) {
+				if (exit_group != 0) {
+					group = exit_group;
+					exit_group = 0;
+				} else if (group == 0) {
+					if (!marked) {
+						Int e;
+
+						// Rebase the input counts of new modules before
+						// their instructions are created.
+						IGD_(resolve_modules)();
+
+						marked = True;
+						for (e = 0; e < vge->n_used; e++)
+							IGD_(mark_code)(vge->base[e], vge->len[e]);
+
+						if (IGD_(snapshots_enabled)())
+							IGD_(add_touch_check)(sbOut, block);
+					}
+
 					group = IGD_(new_group)();
-#if defined(USING_INSTR_CALLBACK)
-					IGD_(add_increment_callback)(sbOut, group);
-#elif defined(USING_INSTR_EXPR)
-					IGD_(add_increment_expr)(sbOut, hWordTy, &(group->exec_count));
-#endif
+					IGD_(block_add_group)(block, group);
+					IGD_(add_group_increment)(sbOut, hWordTy, group, 0);
 				}
 
-				instr = IGD_(get_instr)(st->Ist.IMark.addr, st->Ist.IMark.len);
-				IGD_(smart_list_add)(group->instrs, instr);
+				imark = st;
+				IGD_(group_add_instr)(group, st->Ist.IMark.addr, st->Ist.IMark.len);
 
 				break;
 			case Ist_Exit:
-				group = 0;
+				if (!IGD_(clo).exit_counters)
+					group = 0;
+
 				break;
 			default:
 				break;
 		}
 	}
 
+	IGD_(close_group)();
+
+	// The exit at the end of the superblock.
+	if (IGD_(clo).edges_outfile && imark != 0 && IGD_(is_edge_jump)(sbIn->jumpkind) &&
+			IGD_(is_jump_exit)(imark, sbIn->next))
+		IGD_(add_edge_count)(sbOut, hWordTy, IGD_(imark_instr)(imark), sbIn->next, 0);
+
 	return sbOut;
 }
 
+static
+void IGD_(discard_superblock_info)(Addr orig_addr, VexGuestExtents vge) {
+	IGD_ASSERT(vge.n_used > 0);
+
+	// The superblocks are keyed by the first extent, not orig_addr, since
+	// they differ for redirected code.
+	IGD_(discard_block)(vge.base[0]);
+}
+
+// Retranslate all the code, with or without the counters. The counts of
+// the discarded superblocks are flushed (discard_superblock_info).
+static
+void IGD_(retranslate_all)(void) {
+	VG_(discard_translations_safely)((Addr) 0x1000, ~(SizeT) 0xfff, "instrgrind");
+}
+
+// Apply a change of counting or of the sampling window: the guarded
+// counters are just switched, the other code is retranslated.
+static
+void IGD_(switch_counters)(void) {
+	if (IGD_(clo).counter_mode == CNT_GUARDED)
+		counters_enabled = IGD_(counters_active)();
+	else
+		IGD_(retranslate_all)();
+}
+
+static
+void IGD_(start_client_code)(ThreadId tid, ULong blocks_done) {
+	if (IGD_(clo).separate_threads)
+		IGD_(switch_thread)(tid);
+
+	if (IGD_(snapshots_enabled)())
+		IGD_(check_snapshot)(blocks_done);
+
+	if (IGD_(sampling_enabled)() && IGD_(check_sampling)(blocks_done, counting) && counting)
+		IGD_(switch_counters)();
+}
+
+static
+void IGD_(set_counting)(Bool on) {
+	if (counting == on)
+		return;
+
+	counting = on;
+	IGD_(switch_counters)();
+}
+
+static
+void IGD_(zero_counts)(void) {
+	IGD_(zero_all_blocks)();
+	IGD_(zero_instrs)();
+	IGD_(zero_pending)();
+	IGD_(zero_aggregates)();
+
+	if (IGD_(clo).edges_outfile)
+		IGD_(zero_edges)();
+
+	if (IGD_(clo).separate_threads)
+		IGD_(zero_threads)();
+
+	if (IGD_(snapshots_enabled)())
+		IGD_(zero_snapshots)();
+
+	if (IGD_(sampling_enabled)())
+		IGD_(zero_sampling)();
+}
+
+static
+void IGD_(dump_counts)(const HChar* filename) {
+	HChar* expanded;
+
+	expanded = 0;
+	if (!filename) {
+		if (!IGD_(clo).instrs_outfile)
+			return;
+
+		expanded = VG_(expand_file_name)("--instrs-outfile", IGD_(clo).instrs_outfile);
+		filename = expanded;
+	}
+
+	IGD_(flush_all_blocks)();
+	IGD_(dump_instrs)(filename);
+
+	if (IGD_(clo).separate_threads)
+		IGD_(dump_threads_instrs)(filename);
+
+	if (expanded)
+		IGD_FREE(expanded);
+}
+
+// The child starts with no counts, the parent counts what ran before the
+// fork. The output files must differ (%p) to keep both.
+static
+void IGD_(atfork_child)(ThreadId tid) {
+	IGD_(zero_counts)();
+}
+
+static
+Bool IGD_(handle_client_request)(ThreadId tid, UWord* args, UWord* ret) {
+	if (!VG_IS_TOOL_USERREQ('I', 'G', args[0]))
+		return False;
+
+	switch (args[0]) {
+		case VG_USERREQ__IGD_START_COUNTING:
+			IGD_(set_counting)(True);
+			break;
+		case VG_USERREQ__IGD_STOP_COUNTING:
+			IGD_(set_counting)(False);
+			break;
+		case VG_USERREQ__IGD_ZERO_COUNTS:
+			IGD_(zero_counts)();
+			break;
+		case VG_USERREQ__IGD_DUMP_COUNTS:
+			IGD_(dump_counts)((const HChar*) args[1]);
+			break;
+		default:
+			return False;
+	}
+
+	*ret = 0;
+	return True;
+}
+
+static
+void IGD_(die_mem_munmap)(Addr a, SizeT len) {
+	IGD_(bump_code_generation)(a, len);
+}
+
+// New mappings may load modules with pending input counts.
+static
+void IGD_(new_mem_mmap)(Addr a, SizeT len, Bool rr, Bool ww, Bool xx, ULong di_handle) {
+	IGD_(modules_changed)();
+}
+
+static
+void IGD_(change_mem_mprotect)(Addr a, SizeT len, Bool rr, Bool ww, Bool xx) {
+	// Code that is no longer executable is gone. Code that can be
+	// written keeps its generation until it is translated again.
+	if (!xx)
+		IGD_(bump_code_generation)(a, len);
+	else if (ww)
+		IGD_(mark_code_writable)(a, len);
+
+	// The text of a module can be read when it becomes executable.
+	if (xx)
+		IGD_(modules_changed)();
+}
+
 static
 void dump_mappings(const HChar* filename) {
 	VgFile* outfile;
@@ -242,15 +808,121 @@ void dump_mappings(const HChar* filename) {
 }
 
 static void IGD_(fini)(Int exitcode) {
+	if (VG_(clo_stats)) {
+		IGD_(print_blocks_stats)();
+		IGD_(print_groups_stats)();
+		IGD_(print_counters_stats)();
+		IGD_(print_instrs_stats)();
+
+		if (IGD_(filters_enabled)())
+			IGD_(print_filters_stats)();
+
+		if (IGD_(sampling_enabled)())
+			IGD_(print_sampling_stats)();
+	}
+
+	// The last incremental snapshot, so the snapshots add up to the total.
+	if (IGD_(snapshots_enabled)() && IGD_(clo).dump_incremental)
+		IGD_(take_snapshot)();
+
+	IGD_(destroy_blocks_pool)();
 	IGD_(destroy_groups_pool)();
+	IGD_(destroy_counters)();
+
+	if (IGD_(sampling_enabled)())
+		IGD_(scale_sampled_counts)();
+
+	if (VG_(clo_stats))
+		IGD_(print_increments_stats)();
+
+	if (IGD_(clo).instrs_outfile) {
+		HChar* filename;
+
+		filename = VG_(expand_file_name)("--instrs-outfile", IGD_(clo).instrs_outfile);
+		IGD_(dump_instrs)(filename);
+
+		if (IGD_(clo).separate_threads)
+			IGD_(dump_threads_instrs)(filename);
+
+		IGD_FREE(filename);
+
+		if (VG_(clo_stats))
+			IGD_(print_dump_stats)();
+	}
+
+	if (IGD_(clo).groups_outfile) {
+		HChar* filename;
+
+		filename = VG_(expand_file_name)("--groups-outfile", IGD_(clo).groups_outfile);
+		IGD_(dump_groups)(filename);
 
-	if (IGD_(clo).instrs_outfile)
-		IGD_(dump_instrs)(IGD_(clo).instrs_outfile);
+		IGD_FREE(filename);
+	}
+
+	if (IGD_(clo).funcs_outfile || IGD_(clo).objs_outfile) {
+		HChar* funcs;
+		HChar* objs;
+
+		funcs = IGD_(clo).funcs_outfile ?
+			VG_(expand_file_name)("--funcs-outfile", IGD_(clo).funcs_outfile) : 0;
+		objs = IGD_(clo).objs_outfile ?
+			VG_(expand_file_name)("--objs-outfile", IGD_(clo).objs_outfile) : 0;
+
+		IGD_(dump_funcs_objs)(funcs, objs);
+
+		if (funcs)
+			IGD_FREE(funcs);
+		if (objs)
+			IGD_FREE(objs);
+	}
+
+	if (IGD_(clo).summary_outfile) {
+		HChar* filename;
+
+		filename = VG_(expand_file_name)("--summary-outfile", IGD_(clo).summary_outfile);
+		IGD_(write_summary)(filename);
+
+		IGD_FREE(filename);
+	} else if (IGD_(clo).summary) {
+		IGD_(write_summary)(0);
+	}
+
+	if (IGD_(clo).edges_outfile) {
+		HChar* filename;
+
+		if (VG_(clo_stats))
+			IGD_(print_edges_stats)();
+
+		filename = VG_(expand_file_name)("--edges-outfile", IGD_(clo).edges_outfile);
+		IGD_(dump_edges)(filename);
+
+		IGD_FREE(filename);
+		IGD_(destroy_edges)();
+	}
+
+	if (IGD_(clo).separate_threads)
+		IGD_(destroy_threads)();
+
+	if (IGD_(snapshots_enabled)())
+		IGD_(destroy_snapshots)();
+
+	IGD_(destroy_aggregates)();
+
+	if (IGD_(filters_enabled)())
+		IGD_(destroy_filters)();
 
 	IGD_(destroy_instrs_pool)();
+	IGD_(destroy_modules)();
+	IGD_(destroy_pages_pool)();
 
-	if (IGD_(clo).mappings_outfile)
-		dump_mappings(IGD_(clo).mappings_outfile);
+	if (IGD_(clo).mappings_outfile) {
+		HChar* filename;
+
+		filename = VG_(expand_file_name)("--mappings-outfile", IGD_(clo).mappings_outfile);
+		dump_mappings(filename);
+
+		IGD_FREE(filename);
+	}
 }
 
 static void IGD_(pre_clo_init)(void) {
@@ -270,6 +942,16 @@ static void IGD_(pre_clo_init)(void) {
 	VG_(needs_command_line_options)(IGD_(process_cmd_line_option),
                    IGD_(print_usage), IGD_(print_debug_usage));
 
+	VG_(needs_superblock_discards)(IGD_(discard_superblock_info));
+	VG_(needs_client_requests)(IGD_(handle_client_request));
+
+	VG_(atfork)(NULL, NULL, IGD_(atfork_child));
+
+	VG_(track_start_client_code)(IGD_(start_client_code));
+	VG_(track_new_mem_mmap)(IGD_(new_mem_mmap));
+	VG_(track_die_mem_munmap)(IGD_(die_mem_munmap));
+	VG_(track_change_mem_mprotect)(IGD_(change_mem_mprotect));
+
 	IGD_(clo_set_defaults)();
 }
 
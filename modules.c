@@ -0,0 +1,603 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                    modules.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Modules of the instructions files, so the counts of a run can be
+   loaded in another one where the modules are mapped elsewhere (ASLR).
+
+   The records of the input file that belong to a module are kept as
+   pending until a module with the same file name and text size is found
+   in this run, and then rebased onto its text. Since the libraries are
+   loaded along the run, the new modules are checked before instrumenting
+   code while there are pending records, but only after the mappings
+   changed (main.c), since the last check. The records of modules never
+   loaded are dumped back as they were read.
+
+   In the output, the modules are those of this run, plus the input
+   modules still pending. The absolute formats keep the pending modules
+   too: the binary one in its module table, at their old text addresses,
+   and the text one with "@id" lines and relative records for them only.
+*/
+
+#define RECORDS_PER_SLAB 4096
+
+typedef struct _Module		Module;
+struct _Module {
+	HChar* name;
+	Addr base;          // Text address in the input run, 0 if unknown.
+	SizeT size;         // Text size.
+	Bool resolved;      // Found in this run.
+	SmartList* records; // Pending records, with base + offset addresses.
+};
+
+typedef struct _OutModule	OutModule;
+struct _OutModule {
+	const HChar* name;
+	Addr base;
+	SizeT size;
+	Module* pending; // The input module, if it is not loaded in this run.
+};
+
+static SmartList* input_modules = 0;
+static Int pending_modules = 0;
+static Slab* records_slab = 0;
+
+// The DebugInfo handles already checked against the input modules, and
+// whether new ones may have been loaded since.
+static AddrHash* checked_modules = 0;
+static Bool modules_changed = True;
+
+// The modules of the output file, sorted by name and text size (the
+// index is the id), and those of this run sorted by text address.
+static OutModule* out_modules = 0;
+static OutModule** out_loaded = 0;
+static Int out_count = 0;
+static Int out_loaded_count = 0;
+
+// The input modules still pending, sorted by name and text size, for the
+// absolute formats.
+static Module** out_pending = 0;
+static Int out_pending_count = 0;
+
+void IGD_(init_modules)() {
+	IGD_ASSERT(input_modules == 0);
+
+	input_modules = IGD_(new_smart_list)(16);
+	records_slab = IGD_(new_slab)("igd.modules.im.1", sizeof(UniqueInstr), RECORDS_PER_SLAB);
+	checked_modules = IGD_(new_addr_hash)(256);
+	pending_modules = 0;
+	modules_changed = True;
+}
+
+static
+void delete_module(Module* module) {
+	IGD_FREE(module->name);
+
+	// The records are released with the slab.
+	IGD_(smart_list_clear)(module->records, 0);
+	IGD_(delete_smart_list)(module->records);
+
+	IGD_DATA_FREE(module, sizeof(Module));
+}
+
+void IGD_(destroy_modules)() {
+	IGD_ASSERT(input_modules != 0);
+
+	IGD_(smart_list_clear)(input_modules, (void (*)(void*)) delete_module);
+	IGD_(delete_smart_list)(input_modules);
+	input_modules = 0;
+
+	IGD_(delete_slab)(records_slab);
+	records_slab = 0;
+
+	IGD_(addr_hash_clear)(checked_modules, 0);
+	IGD_(delete_addr_hash)(checked_modules);
+	checked_modules = 0;
+
+	if (out_modules) {
+		IGD_FREE(out_modules);
+		IGD_FREE(out_loaded);
+		out_modules = 0;
+		out_loaded = 0;
+		out_count = 0;
+		out_loaded_count = 0;
+	}
+
+	if (out_pending) {
+		IGD_FREE(out_pending);
+		out_pending = 0;
+		out_pending_count = 0;
+	}
+}
+
+// Add a module of the input file, returning its handle. The name is
+// copied.
+Int IGD_(add_input_module)(const HChar* name, Addr base, SizeT size) {
+	Module* module;
+
+	IGD_ASSERT(name != 0);
+
+	module = (Module*) IGD_MALLOC("igd.modules.aim.1", sizeof(Module));
+	module->name = IGD_STRDUP("igd.modules.aim.2", name);
+	module->base = base;
+	module->size = size;
+	module->resolved = False;
+	module->records = IGD_(new_smart_list)(64);
+
+	IGD_(smart_list_add)(input_modules, module);
+
+	return IGD_(smart_list_count)(input_modules) - 1;
+}
+
+// Add the record at the offset of the input module text.
+void IGD_(add_module_record)(Int handle, Addr offset, Int size, UInt gen, ULong count) {
+	Module* module;
+	UniqueInstr* record;
+
+	module = (Module*) IGD_(smart_list_at)(input_modules, handle);
+	IGD_ASSERT(module != 0);
+	IGD_ASSERT(!module->resolved);
+
+	record = (UniqueInstr*) IGD_(slab_alloc)(records_slab);
+	record->addr = module->base + offset;
+	record->size = size;
+	record->gen = gen;
+	record->exec_count = count;
+
+	if (IGD_(smart_list_is_empty)(module->records))
+		pending_modules++;
+
+	IGD_(smart_list_add)(module->records, record);
+}
+
+// Drop the counts of the pending records, but keep the records.
+void IGD_(zero_pending)(void) {
+	Int i, j, count, size;
+	Module* module;
+
+	count = IGD_(smart_list_count)(input_modules);
+	for (i = 0; i < count; i++) {
+		module = (Module*) IGD_(smart_list_at)(input_modules, i);
+
+		size = IGD_(smart_list_count)(module->records);
+		for (j = 0; j < size; j++)
+			((UniqueInstr*) IGD_(smart_list_at)(module->records, j))->exec_count = 0;
+	}
+}
+
+static
+void resolve_module(Module* module, const DebugInfo* di) {
+	Int i, count;
+	Addr text;
+	UniqueInstr* record;
+
+	text = VG_(DebugInfo_get_text_avma)(di);
+
+	count = IGD_(smart_list_count)(module->records);
+	for (i = 0; i < count; i++) {
+		record = (UniqueInstr*) IGD_(smart_list_at)(module->records, i);
+		IGD_(add_instr_count)(text + (record->addr - module->base),
+			record->size, record->gen, record->exec_count);
+
+		IGD_(slab_free)(records_slab, record);
+	}
+
+	IGD_(smart_list_clear)(module->records, 0);
+
+	module->resolved = True;
+	pending_modules--;
+}
+
+static
+void check_module(const DebugInfo* di) {
+	Int i, count;
+	const HChar* name;
+	SizeT size;
+	Module* module;
+
+	name = VG_(DebugInfo_get_filename)(di);
+	size = VG_(DebugInfo_get_text_size)(di);
+
+	count = IGD_(smart_list_count)(input_modules);
+	for (i = 0; i < count; i++) {
+		module = (Module*) IGD_(smart_list_at)(input_modules, i);
+		if (module->resolved || IGD_(smart_list_is_empty)(module->records) ||
+				VG_(strcmp)(module->name, name) != 0)
+			continue;
+
+		// Without a build id, the text size tells a rebuilt module.
+		if (module->size != size) {
+			VG_(umsg)("instrgrind: %s changed since the input profile,"
+				" its counts are kept apart\n", name);
+			continue;
+		}
+
+		resolve_module(module, di);
+		break;
+	}
+}
+
+// Called when memory is mapped, which may load new modules.
+void IGD_(modules_changed)(void) {
+	modules_changed = True;
+}
+
+// Rebase the pending records of the modules loaded since the last call.
+void IGD_(resolve_modules)(void) {
+	const DebugInfo* di;
+	Addr handle;
+
+	if (pending_modules == 0 || !modules_changed)
+		return;
+
+	modules_changed = False;
+
+	for (di = VG_(next_DebugInfo)(0); di; di = VG_(next_DebugInfo)(di)) {
+		if (!VG_(DebugInfo_get_text_avma)(di))
+			continue;
+
+		// The handles start from 1.
+		handle = (Addr) VG_(DebugInfo_get_handle)(di);
+		if (IGD_(addr_hash_contains)(checked_modules, handle))
+			continue;
+
+		IGD_(addr_hash_put)(checked_modules, handle, (void*) di);
+		check_module(di);
+	}
+}
+
+static
+Int cmp_out_names(const void* p1, const void* p2) {
+	const OutModule* m1 = (const OutModule*) p1;
+	const OutModule* m2 = (const OutModule*) p2;
+	Int r;
+
+	r = VG_(strcmp)(m1->name, m2->name);
+	if (r != 0)
+		return r;
+
+	if (m1->size != m2->size)
+		return m1->size < m2->size ? -1 : 1;
+
+	return m1->base < m2->base ? -1 : (m1->base > m2->base ? 1 : 0);
+}
+
+static
+Int cmp_out_bases(const void* p1, const void* p2) {
+	const OutModule* m1 = *((const OutModule* const*) p1);
+	const OutModule* m2 = *((const OutModule* const*) p2);
+
+	return m1->base < m2->base ? -1 : (m1->base > m2->base ? 1 : 0);
+}
+
+// Write the "@id" lines of the modules of this run and of the input
+// modules still pending, and prepare IGD_(module_offset). The ids follow
+// the order of the names, the same in the files of every run, so sorted
+// files can be merged as streams (igd_merge).
+void IGD_(write_text_modules)(FileWriter* fw) {
+	Int i, count, id;
+	const DebugInfo* di;
+	Module* module;
+
+	if (out_modules) {
+		IGD_FREE(out_modules);
+		IGD_FREE(out_loaded);
+	}
+
+	out_count = 0;
+	for (di = VG_(next_DebugInfo)(0); di; di = VG_(next_DebugInfo)(di)) {
+		if (VG_(DebugInfo_get_text_avma)(di))
+			out_count++;
+	}
+	out_loaded_count = out_count;
+
+	count = IGD_(smart_list_count)(input_modules);
+	for (i = 0; i < count; i++) {
+		module = (Module*) IGD_(smart_list_at)(input_modules, i);
+		if (!module->resolved && !IGD_(smart_list_is_empty)(module->records))
+			out_count++;
+	}
+
+	out_modules = (OutModule*) IGD_MALLOC("igd.modules.wtm.1",
+						((out_count + 1) * sizeof(OutModule)));
+	out_loaded = (OutModule**) IGD_MALLOC("igd.modules.wtm.2",
+						((out_loaded_count + 1) * sizeof(OutModule*)));
+
+	id = 0;
+	for (di = VG_(next_DebugInfo)(0); di; di = VG_(next_DebugInfo)(di)) {
+		Addr text;
+
+		text = VG_(DebugInfo_get_text_avma)(di);
+		if (!text)
+			continue;
+
+		out_modules[id].name = VG_(DebugInfo_get_filename)(di);
+		out_modules[id].base = text;
+		out_modules[id].size = VG_(DebugInfo_get_text_size)(di);
+		out_modules[id].pending = 0;
+		id++;
+	}
+
+	for (i = 0; i < count; i++) {
+		module = (Module*) IGD_(smart_list_at)(input_modules, i);
+		if (module->resolved || IGD_(smart_list_is_empty)(module->records))
+			continue;
+
+		out_modules[id].name = module->name;
+		out_modules[id].base = module->base;
+		out_modules[id].size = module->size;
+		out_modules[id].pending = module;
+		id++;
+	}
+	IGD_ASSERT(id == out_count);
+
+	VG_(ssort)(out_modules, out_count, sizeof(OutModule), cmp_out_names);
+
+	id = 0;
+	for (i = 0; i < out_count; i++) {
+		IGD_(write_text_module)(fw, i, out_modules[i].size, out_modules[i].name);
+
+		if (!out_modules[i].pending)
+			out_loaded[id++] = &out_modules[i];
+	}
+
+	VG_(ssort)(out_loaded, out_loaded_count, sizeof(OutModule*), cmp_out_bases);
+}
+
+// The output module of the address, or -1 if it is not in any.
+Int IGD_(module_offset)(Addr addr, Addr* offset) {
+	Int lo, hi, mid;
+
+	lo = 0;
+	hi = out_loaded_count - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (addr < out_loaded[mid]->base) {
+			hi = mid - 1;
+		} else if (addr >= (out_loaded[mid]->base + out_loaded[mid]->size)) {
+			lo = mid + 1;
+		} else {
+			*offset = addr - out_loaded[mid]->base;
+			return out_loaded[mid] - out_modules;
+		}
+	}
+
+	return -1;
+}
+
+// The first instruction at or after the address.
+static
+Int lower_bound(UniqueInstr** instrs, Int count, Addr addr) {
+	Int lo, hi, mid;
+
+	lo = 0;
+	hi = count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (instrs[mid]->addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static
+void write_pending_module(FileWriter* fw, Int id, Module* module) {
+	Int i, count;
+	UniqueInstr** records;
+
+	count = IGD_(smart_list_count)(module->records);
+	records = (UniqueInstr**) IGD_MALLOC("igd.modules.wpm.1",
+						((count + 1) * sizeof(UniqueInstr*)));
+	for (i = 0; i < count; i++)
+		records[i] = (UniqueInstr*) IGD_(smart_list_at)(module->records, i);
+
+	IGD_(sort_instrs)(records, count);
+
+	for (i = 0; i < count; i++)
+		IGD_(write_text_record)(fw, id, records[i]->addr - module->base,
+			records[i]->size, records[i]->gen, records[i]->exec_count);
+
+	IGD_FREE(records);
+}
+
+// Write the instructions (sorted by address) relative to their modules,
+// after IGD_(write_text_modules): first those outside any module, with
+// absolute addresses, then those of each module in the id order, which
+// are contiguous in the array. With pending, the records of the modules
+// not loaded are written in their place too.
+void IGD_(write_relative_records)(FileWriter* fw, UniqueInstr** instrs, Int count, Bool pending) {
+	Int i, id;
+	Addr offset;
+	OutModule* module;
+
+	for (i = 0; i < count; i++) {
+		if (IGD_(module_offset)(instrs[i]->addr, &offset) < 0)
+			IGD_(write_text_record)(fw, -1, instrs[i]->addr, instrs[i]->size,
+				instrs[i]->gen, instrs[i]->exec_count);
+	}
+
+	for (id = 0; id < out_count; id++) {
+		module = &out_modules[id];
+		if (module->pending) {
+			if (pending)
+				write_pending_module(fw, id, module->pending);
+
+			continue;
+		}
+
+		i = lower_bound(instrs, count, module->base);
+		for (; i < count && instrs[i]->addr < (module->base + module->size); i++)
+			IGD_(write_text_record)(fw, id, instrs[i]->addr - module->base,
+				instrs[i]->size, instrs[i]->gen, instrs[i]->exec_count);
+	}
+}
+
+static
+Int cmp_pending_names(const void* p1, const void* p2) {
+	const Module* m1 = *((const Module* const*) p1);
+	const Module* m2 = *((const Module* const*) p2);
+	Int r;
+
+	r = VG_(strcmp)(m1->name, m2->name);
+	if (r != 0)
+		return r;
+
+	return m1->size < m2->size ? -1 : (m1->size > m2->size ? 1 : 0);
+}
+
+// Collect the input modules still pending, for the IGD_(write_pending_*)
+// functions, returning their count.
+Int IGD_(prepare_pending_modules)(void) {
+	Int i, count;
+	Module* module;
+
+	if (out_pending)
+		IGD_FREE(out_pending);
+
+	count = IGD_(smart_list_count)(input_modules);
+	out_pending = (Module**) IGD_MALLOC("igd.modules.ppm.1",
+						((count + 1) * sizeof(Module*)));
+
+	out_pending_count = 0;
+	for (i = 0; i < count; i++) {
+		module = (Module*) IGD_(smart_list_at)(input_modules, i);
+		if (!module->resolved && !IGD_(smart_list_is_empty)(module->records))
+			out_pending[out_pending_count++] = module;
+	}
+
+	VG_(ssort)(out_pending, out_pending_count, sizeof(Module*), cmp_pending_names);
+
+	return out_pending_count;
+}
+
+static
+Bool ranges_overlap(Addr b1, SizeT s1, Addr b2, SizeT s2) {
+	return b1 < (b2 + s2) && b2 < (b1 + s1);
+}
+
+// Whether the old text of a pending module overlaps the text of a module
+// of this run or of another pending one, so their records could not be
+// told apart by address.
+Bool IGD_(pending_modules_overlap)(void) {
+	Int i, j;
+	Module* module;
+	const DebugInfo* di;
+
+	for (i = 0; i < out_pending_count; i++) {
+		module = out_pending[i];
+		if (module->base == 0)
+			return True;
+
+		for (di = VG_(next_DebugInfo)(0); di; di = VG_(next_DebugInfo)(di)) {
+			Addr text = VG_(DebugInfo_get_text_avma)(di);
+			if (text && ranges_overlap(module->base, module->size,
+					text, VG_(DebugInfo_get_text_size)(di)))
+				return True;
+		}
+
+		for (j = i + 1; j < out_pending_count; j++) {
+			if (ranges_overlap(module->base, module->size,
+					out_pending[j]->base, out_pending[j]->size))
+				return True;
+		}
+	}
+
+	return False;
+}
+
+// Write the pending modules to the binary module table, at their old
+// text addresses. Their records are written with the others.
+void IGD_(write_pending_binary_modules)(FileWriter* fw) {
+	Int i;
+
+	for (i = 0; i < out_pending_count; i++) {
+		IGD_ASSERT(out_pending[i]->base != 0);
+		IGD_(write_binary_module)(fw, out_pending[i]->name,
+			out_pending[i]->base, out_pending[i]->size);
+	}
+}
+
+// Write the "@id" lines of the pending modules in an absolute text file.
+void IGD_(write_pending_text_modules)(FileWriter* fw) {
+	Int i;
+
+	for (i = 0; i < out_pending_count; i++)
+		IGD_(write_text_module)(fw, i, out_pending[i]->size, out_pending[i]->name);
+}
+
+// Write the records of the pending modules relative to them, after the
+// absolute records.
+void IGD_(write_pending_text_records)(FileWriter* fw) {
+	Int i;
+
+	for (i = 0; i < out_pending_count; i++)
+		write_pending_module(fw, i, out_pending[i]);
+}
+
+// Number of pending records, written with absolute addresses in the
+// binary output.
+Int IGD_(pending_count)(void) {
+	Int i, count, total;
+	Module* module;
+
+	total = 0;
+	count = IGD_(smart_list_count)(input_modules);
+	for (i = 0; i < count; i++) {
+		module = (Module*) IGD_(smart_list_at)(input_modules, i);
+		if (!module->resolved)
+			total += IGD_(smart_list_count)(module->records);
+	}
+
+	return total;
+}
+
+// Collect the pending records with absolute addresses, for the binary
+// output. The modules with unknown addresses (from relative text) are
+// refused with it (instrs.c).
+void IGD_(collect_pending)(UniqueInstr*** next) {
+	Int i, j, count, size;
+	Module* module;
+
+	count = IGD_(smart_list_count)(input_modules);
+	for (i = 0; i < count; i++) {
+		module = (Module*) IGD_(smart_list_at)(input_modules, i);
+		if (module->resolved)
+			continue;
+
+		size = IGD_(smart_list_count)(module->records);
+		IGD_ASSERT(size == 0 || module->base != 0);
+
+		for (j = 0; j < size; j++)
+			*((*next)++) = (UniqueInstr*) IGD_(smart_list_at)(module->records, j);
+	}
+}
@@ -0,0 +1,189 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                      pages.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Generation of the guest pages that had code translated. A page
+   generation is bumped whenever the page loses its code (it is unmapped
+   or no longer executable), or has code translated again after it could
+   be written, so the instructions seen at the same address afterwards
+   are counted apart from the old ones (see instrs.c). A permission
+   change alone, as the W^X toggles of JIT compilers or the remapping of
+   RELRO, keeps the generation.
+*/
+
+#define PAGE_BITS 12
+#define DEFAULT_POOL_SIZE 16384 // 16k pages
+#define PAGES_PER_SLAB 4096
+
+typedef struct _CodePage	CodePage;
+struct _CodePage {
+	Addr page;
+	UInt gen;
+	Bool written; // Writable since the code was translated.
+};
+
+AddrHash* pages_pool = 0;
+Slab* pages_slab = 0;
+
+// Cache for the last page looked up.
+static CodePage* last_page = 0;
+
+void IGD_(init_pages_pool)() {
+	IGD_ASSERT(pages_pool == 0);
+	IGD_ASSERT(pages_slab == 0);
+
+	pages_pool = IGD_(new_addr_hash)(DEFAULT_POOL_SIZE);
+	pages_slab = IGD_(new_slab)("igd.pages.mc.1", sizeof(CodePage), PAGES_PER_SLAB);
+}
+
+void IGD_(destroy_pages_pool)() {
+	IGD_ASSERT(pages_pool != 0);
+	IGD_ASSERT(pages_slab != 0);
+
+	IGD_(addr_hash_clear)(pages_pool, 0);
+	IGD_(delete_addr_hash)(pages_pool);
+	pages_pool = 0;
+
+	IGD_(delete_slab)(pages_slab);
+	pages_slab = 0;
+
+	last_page = 0;
+}
+
+static
+CodePage* find_page(Addr page) {
+	if (last_page && last_page->page == page)
+		return last_page;
+
+	last_page = (CodePage*) IGD_(addr_hash_get)(pages_pool, page);
+	return last_page;
+}
+
+// Record that the guest range [addr, addr+size) has translated code.
+void IGD_(mark_code)(Addr addr, SizeT size) {
+	Addr page, last;
+	CodePage* cp;
+
+	if (size == 0)
+		return;
+
+	last = (addr + size - 1) >> PAGE_BITS;
+	for (page = addr >> PAGE_BITS; page <= last; page++) {
+		if ((cp = find_page(page))) {
+			// The code may have been rewritten.
+			if (cp->written) {
+				cp->gen++;
+				cp->written = False;
+			}
+
+			continue;
+		}
+
+		cp = (CodePage*) IGD_(slab_alloc)(pages_slab);
+		cp->page = page;
+		cp->gen = 0;
+		cp->written = False;
+
+		IGD_(addr_hash_put)(pages_pool, page, cp);
+		last_page = cp;
+	}
+}
+
+UInt IGD_(code_generation)(Addr addr) {
+	CodePage* cp;
+
+	cp = find_page(addr >> PAGE_BITS);
+	return cp ? cp->gen : 0;
+}
+
+static
+Bool write_page(CodePage* cp, Addr* range) {
+	if (cp->page >= range[0] && cp->page <= range[1])
+		cp->written = True;
+
+	return False;
+}
+
+// The code in the guest range [addr, addr+size) can be written, so it
+// starts a new generation if it is translated again.
+void IGD_(mark_code_writable)(Addr addr, SizeT size) {
+	Addr range[2];
+	CodePage* cp;
+
+	if (size == 0 || IGD_(addr_hash_is_empty)(pages_pool))
+		return;
+
+	range[0] = addr >> PAGE_BITS;
+	range[1] = (addr + size - 1) >> PAGE_BITS;
+
+	if ((range[1] - range[0]) >= (Addr) IGD_(addr_hash_count)(pages_pool)) {
+		IGD_(addr_hash_forall)(pages_pool, (Bool (*)(void*, void*)) write_page, range);
+	} else {
+		Addr page;
+
+		for (page = range[0]; page <= range[1]; page++) {
+			if ((cp = find_page(page)))
+				cp->written = True;
+		}
+	}
+}
+
+static
+Bool bump_page(CodePage* cp, Addr* range) {
+	if (cp->page >= range[0] && cp->page <= range[1])
+		cp->gen++;
+
+	return False;
+}
+
+// The code in the guest range [addr, addr+size) is gone or has changed.
+void IGD_(bump_code_generation)(Addr addr, SizeT size) {
+	Addr range[2];
+	CodePage* cp;
+
+	if (size == 0 || IGD_(addr_hash_is_empty)(pages_pool))
+		return;
+
+	range[0] = addr >> PAGE_BITS;
+	range[1] = (addr + size - 1) >> PAGE_BITS;
+
+	// Large ranges (mostly data being unmapped) are cheaper to check
+	// against the code pages than page by page.
+	if ((range[1] - range[0]) >= (Addr) IGD_(addr_hash_count)(pages_pool)) {
+		IGD_(addr_hash_forall)(pages_pool, (Bool (*)(void*, void*)) bump_page, range);
+	} else {
+		Addr page;
+
+		for (page = range[0]; page <= range[1]; page++) {
+			if ((cp = find_page(page)))
+				cp->gen++;
+		}
+	}
+}
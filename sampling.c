@@ -0,0 +1,140 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                   sampling.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Sampled counting (--sample-period): only the first --sample-window
+   superblocks of each period are executed with counters, and the code is
+   retranslated without them for the rest of the period, so it runs as
+   fast as when counting is stopped. The windows are checked when a thread
+   starts running client code, like the snapshots, so they are as precise
+   as the thread switches: a scheduling quantum is 100000 superblocks, the
+   default window, and shorter windows usually last as long, so the
+   sampling cannot be finer than a timeslice.
+
+   The superblocks executed while counting is on are accounted by window,
+   and at exit the counts are scaled by the ratio of all of them to the
+   sampled ones, so they estimate the counts of the full run.
+*/
+
+static Bool in_window = True;
+static ULong window_start = 0;  // Superblocks done when the period began.
+static ULong last_blocks = 0;
+static ULong sampled_blocks = 0;
+static ULong total_blocks = 0;
+static Int windows = 0;
+
+void IGD_(init_sampling)(void) {
+	if (IGD_(clo).sample_window >= IGD_(clo).sample_period)
+		VG_(fmsg_bad_option)("--sample-window",
+			"The window must be shorter than the period (--sample-period=%lld)\n",
+			IGD_(clo).sample_period);
+
+	if (IGD_(clo).instrs_infile)
+		VG_(fmsg_bad_option)("--sample-period",
+			"The counts of --instrs-infile would be scaled too\n");
+
+	in_window = True;
+	window_start = last_blocks = 0;
+	sampled_blocks = total_blocks = 0;
+	windows = 1;
+}
+
+Bool IGD_(sampling_enabled)(void) {
+	return IGD_(clo).sample_period > 0;
+}
+
+// Whether the code is translated with counters now.
+Bool IGD_(sampling_window)(void) {
+	return in_window;
+}
+
+// Called when a thread starts running, with the superblocks executed so
+// far and whether the client is counting. Returns whether the window was
+// opened or closed, so the code must be retranslated.
+Bool IGD_(check_sampling)(ULong blocks_done, Bool counting) {
+	ULong elapsed;
+	Bool was_in_window;
+
+	if (counting) {
+		total_blocks += blocks_done - last_blocks;
+		if (in_window)
+			sampled_blocks += blocks_done - last_blocks;
+	}
+	last_blocks = blocks_done;
+
+	was_in_window = in_window;
+
+	elapsed = blocks_done - window_start;
+	if (elapsed >= (ULong) IGD_(clo).sample_period) {
+		window_start = blocks_done;
+		in_window = True;
+		windows++;
+	} else {
+		in_window = elapsed < (ULong) IGD_(clo).sample_window;
+	}
+
+	return in_window != was_in_window;
+}
+
+// Restart the accounting, with the counts.
+void IGD_(zero_sampling)(void) {
+	sampled_blocks = total_blocks = 0;
+}
+
+// The estimated count of the full run.
+ULong IGD_(sampled_count)(ULong count) {
+	if (sampled_blocks == 0 || sampled_blocks == total_blocks)
+		return count;
+
+	return (ULong) ((Double) count * total_blocks / sampled_blocks + 0.5);
+}
+
+static
+Bool scale_instr(UniqueInstr* instr, void* arg) {
+	instr->exec_count = IGD_(sampled_count)(instr->exec_count);
+	return False;
+}
+
+// Scale all the counts at exit. The blocks must be flushed already.
+void IGD_(scale_sampled_counts)(void) {
+	IGD_(forall_instrs)(scale_instr, 0);
+	IGD_(scale_aggregates)();
+
+	if (IGD_(clo).edges_outfile)
+		IGD_(scale_edges)();
+
+	if (IGD_(clo).separate_threads)
+		IGD_(scale_threads)();
+}
+
+void IGD_(print_sampling_stats)(void) {
+	VG_(dmsg)("sampling: %'d windows, %'llu of %'llu superblocks counted\n",
+		windows, sampled_blocks, total_blocks);
+}
@@ -0,0 +1,164 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                       slab.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Bump pointer allocator for small objects of a fixed size. Objects are
+   carved from large chunks, so there is no per object header, and all
+   the chunks are released at once when the slab is deleted. Freed
+   objects are kept in a free list and reused by the next allocations.
+*/
+
+typedef struct _SlabChunk	SlabChunk;
+struct _SlabChunk {
+	SlabChunk* next;
+};
+
+typedef struct _SlabFree	SlabFree;
+struct _SlabFree {
+	SlabFree* next;
+};
+
+struct _Slab {
+	const HChar* cc;
+	Int elem_size;
+	Int per_chunk;
+
+	Int live;       // Number of objects allocated and not freed.
+	Int nchunks;
+
+	UChar* next;    // Next free object in the current chunk.
+	UChar* end;     // End of the current chunk.
+	SlabChunk* chunks;
+	SlabFree* free_list;
+};
+
+static
+void new_chunk(Slab* slab) {
+	SlabChunk* chunk;
+	SizeT header;
+
+	// Keep the objects aligned on the chunk.
+	header = (sizeof(SlabChunk) + 15) & ~((SizeT) 15);
+
+	chunk = (SlabChunk*) IGD_MALLOC(slab->cc,
+				header + ((SizeT) slab->elem_size * slab->per_chunk));
+	chunk->next = slab->chunks;
+	slab->chunks = chunk;
+	slab->nchunks++;
+
+	slab->next = ((UChar*) chunk) + header;
+	slab->end = slab->next + ((SizeT) slab->elem_size * slab->per_chunk);
+}
+
+Slab* IGD_(new_slab)(const HChar* cc, Int elem_size, Int per_chunk) {
+	Slab* slab;
+
+	IGD_ASSERT(cc != 0);
+	IGD_ASSERT(elem_size > 0);
+	IGD_ASSERT(per_chunk > 0);
+
+	slab = (Slab*) IGD_MALLOC("igd.slab.ns.1", sizeof(Slab));
+	VG_(memset)(slab, 0, sizeof(Slab));
+
+	// Room for the free list link and word aligned.
+	if (elem_size < sizeof(SlabFree))
+		elem_size = sizeof(SlabFree);
+	elem_size = (elem_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+
+	slab->cc = cc;
+	slab->elem_size = elem_size;
+	slab->per_chunk = per_chunk;
+
+	return slab;
+}
+
+// Release all the chunks, including the objects still allocated.
+void IGD_(delete_slab)(Slab* slab) {
+	SlabChunk* chunk;
+
+	IGD_ASSERT(slab != 0);
+
+	chunk = slab->chunks;
+	while (chunk) {
+		SlabChunk* tmp = chunk->next;
+		IGD_FREE(chunk);
+		chunk = tmp;
+	}
+
+	IGD_DATA_FREE(slab, sizeof(Slab));
+}
+
+void* IGD_(slab_alloc)(Slab* slab) {
+	void* elem;
+
+	IGD_ASSERT(slab != 0);
+
+	if (slab->free_list) {
+		elem = slab->free_list;
+		slab->free_list = slab->free_list->next;
+	} else {
+		if (slab->next == slab->end)
+			new_chunk(slab);
+
+		elem = slab->next;
+		slab->next += slab->elem_size;
+	}
+
+	slab->live++;
+	return elem;
+}
+
+void IGD_(slab_free)(Slab* slab, void* elem) {
+	SlabFree* sf;
+
+	IGD_ASSERT(slab != 0);
+	IGD_ASSERT(elem != 0);
+	IGD_ASSERT(slab->live > 0);
+
+#ifdef IGD_DEBUG_FREE
+	VG_(memset)(elem, 0x41, slab->elem_size);
+#endif
+
+	sf = (SlabFree*) elem;
+	sf->next = slab->free_list;
+	slab->free_list = sf;
+
+	slab->live--;
+}
+
+Int IGD_(slab_count)(Slab* slab) {
+	IGD_ASSERT(slab != 0);
+	return slab->live;
+}
+
+SizeT IGD_(slab_bytes)(Slab* slab) {
+	IGD_ASSERT(slab != 0);
+	return (SizeT) slab->nchunks * slab->elem_size * slab->per_chunk;
+}
@@ -39,6 +39,7 @@ struct _SmartHash {
 	Float growth_rate;
 #ifdef OPTIMIZED_HASHTABLE
 	SmartList* track;
+	Int* slots; // position of each tracked cell in track
 #endif
 	SmartList** table; // SmartList<void*>
 };
@@ -56,26 +57,37 @@ void add_tracking_value(SmartHash* shash, Int index) {
 	v = (void*) (((HWord) index) + 1);
 	IGD_ASSERT(shash->table[index] != 0 && IGD_(smart_list_count)(shash->table[index]) == 1);
 //	IGD_ASSERT(!IGD_(smart_list_contains)(shash->track, v, cmp_values));
+	shash->slots[index] = IGD_(smart_list_count)(shash->track);
 	IGD_(smart_list_add)(shash->track, v);
 }
 
 static
 void remove_tracking_value(SmartHash* shash, Int index) {
-	Int i, count;
+	Int i, last;
+	void* v;
 
 	IGD_ASSERT(shash->table[index] == 0 || IGD_(smart_list_is_empty)(shash->table[index]));
 
-	count = IGD_(smart_list_count)(shash->track);
-	for (i = 0; i < count; i++) {
-		Int v = ((HWord) IGD_(smart_list_at)(shash->track, i)) - 1;
-		if (v == index) {
-			IGD_(smart_list_set)(shash->track, i, IGD_(smart_list_at)(shash->track, (count - 1)));
-			IGD_(smart_list_set)(shash->track, (count - 1), 0);
-			return;
-		}
-	}
+	// Move the last tracked cell to the position of the removed one.
+	i = shash->slots[index];
+	last = IGD_(smart_list_count)(shash->track) - 1;
+	IGD_ASSERT(i >= 0 && i <= last);
+	IGD_ASSERT(((HWord) IGD_(smart_list_at)(shash->track, i)) - 1 == (HWord) index);
+
+	v = IGD_(smart_list_at)(shash->track, last);
+	IGD_(smart_list_set)(shash->track, i, v);
+	shash->slots[((HWord) v) - 1] = i;
+	IGD_(smart_list_set)(shash->track, last, 0);
+}
+
+// The lists of the cells that are not tracked anymore are deleted, since
+// only the tracked cells are visited when the hash is cleared or deleted.
+static
+void drop_tracked_list(SmartHash* shash, Int index) {
+	IGD_ASSERT(shash->table[index] != 0 && IGD_(smart_list_is_empty)(shash->table[index]));
 
-	tl_assert(0);
+	IGD_(delete_smart_list)(shash->table[index]);
+	shash->table[index] = 0;
 }
 #endif
 
@@ -90,6 +102,7 @@ void grow_smart_hash(SmartHash* shash, HWord (*hash_key)(void*)) {
 	SmartList** new_list;
 #ifdef OPTIMIZED_HASHTABLE
 	SmartList* new_track;
+	Int* new_slots;
 #endif
 
 	new_size = (Int) (shash->size * shash->growth_rate);
@@ -100,6 +113,7 @@ void grow_smart_hash(SmartHash* shash, HWord (*hash_key)(void*)) {
 
 #ifdef OPTIMIZED_HASHTABLE
 	new_track = IGD_(new_smart_list)(128);
+	new_slots = (Int*) IGD_MALLOC("igd.smarthash.gsh.2", (new_size * sizeof(Int)));
 
 	count = IGD_(smart_list_count)(shash->track);
 	for (i = 0; i < count; i++) {
@@ -128,8 +142,10 @@ void grow_smart_hash(SmartHash* shash, HWord (*hash_key)(void*)) {
 
 			IGD_(smart_list_add)(*new_list, value);
 #ifdef OPTIMIZED_HASHTABLE
-			if (IGD_(smart_list_count)(*new_list) == 1)
+			if (IGD_(smart_list_count)(*new_list) == 1) {
+				new_slots[new_idx] = IGD_(smart_list_count)(new_track);
 				IGD_(smart_list_add)(new_track, (void*) (((HWord) new_idx) + 1));
+			}
 #endif
 
 			IGD_(smart_list_set)(list, j, 0);
@@ -146,8 +162,10 @@ void grow_smart_hash(SmartHash* shash, HWord (*hash_key)(void*)) {
 #ifdef OPTIMIZED_HASHTABLE
 	IGD_(smart_list_clear)(shash->track, 0);
 	IGD_(delete_smart_list)(shash->track);
+	IGD_FREE(shash->slots);
 
 	shash->track = new_track;
+	shash->slots = new_slots;
 #endif
 }
 
@@ -169,6 +187,7 @@ SmartHash* create_smart_hash(Int size, Bool fixed) {
 
 #ifdef OPTIMIZED_HASHTABLE
 	shash->track = IGD_(new_smart_list)(128);
+	shash->slots = (Int*) IGD_MALLOC("igd.smarthash.nsh.3", (size * sizeof(Int)));
 #endif
 
 	shash->table = (SmartList**) IGD_MALLOC("igd.smarthash.nsh.2", (size * sizeof(SmartList*)));
@@ -213,6 +232,7 @@ void IGD_(delete_smart_hash)(SmartHash* shash) {
 #ifdef OPTIMIZED_HASHTABLE
 	IGD_ASSERT(IGD_(smart_list_is_empty)(shash->track));
 	IGD_(delete_smart_list)(shash->track);
+	IGD_FREE(shash->slots);
 #endif
 
 	IGD_FREE(shash->table);
@@ -252,6 +272,10 @@ void IGD_(smart_hash_clear)(SmartHash* shash, void (*remove_value)(void*)) {
 			--shash->count;
 			IGD_(smart_list_set)(list, j, 0);
 		}
+
+#ifdef OPTIMIZED_HASHTABLE
+		drop_tracked_list(shash, idx);
+#endif
 	}
 
 #ifdef OPTIMIZED_HASHTABLE
@@ -385,8 +409,10 @@ void* IGD_(smart_hash_remove)(SmartHash* shash, HWord key, HWord (*hash_key)(voi
 				--shash->count;
 
 #ifdef OPTIMIZED_HASHTABLE
-				if (IGD_(smart_list_is_empty)(list))
+				if (IGD_(smart_list_is_empty)(list)) {
 					remove_tracking_value(shash, idx);
+					drop_tracked_list(shash, idx);
+				}
 #endif
 
 				// Return the old value.
@@ -445,8 +471,8 @@ void IGD_(smart_hash_forall)(SmartHash* shash, Bool (*func)(void*, void*), void*
 
 #ifdef OPTIMIZED_HASHTABLE
 		if (IGD_(smart_list_is_empty)(list)) {
-			IGD_(smart_list_set)(shash->track, i, IGD_(smart_list_at)(shash->track, (count - 1)));
-			IGD_(smart_list_set)(shash->track, (count - 1), 0);
+			remove_tracking_value(shash, idx);
+			drop_tracked_list(shash, idx);
 
 			--count;
 		} else {
@@ -490,6 +516,10 @@ void IGD_(smart_hash_merge)(SmartHash* dst, SmartHash* src, HWord (*hash_key)(vo
 
 			IGD_(smart_hash_put)(dst, v, hash_key);
 		}
+
+#ifdef OPTIMIZED_HASHTABLE
+		drop_tracked_list(src, idx);
+#endif
 	}
 
 	IGD_ASSERT(IGD_(smart_hash_is_empty)(src));
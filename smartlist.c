@@ -109,6 +109,9 @@ void grow_smart_list(SmartList* slist) {
 #else
 	{
 		Int new_size = (Int) (slist->size * slist->growth_rate);
+		// Small lists with rates below 2 would not grow otherwise.
+		if (new_size <= slist->size)
+			new_size = slist->size + 1;
 		IGD_ASSERT(new_size > slist->size);
 		IGD_DEBUG(3, "%d\n", new_size);
 
@@ -0,0 +1,185 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                   snapshot.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Snapshots of the execution counts, dumped while the client runs to
+   "<outfile>.<n>" files, every --dump-every-bb superblocks or every
+   --dump-interval milliseconds. They are checked when a thread starts
+   running client code, so they are as frequent as the thread switches
+   at most. Only the superblocks executed since the previous snapshot
+   are flushed (blocks.c).
+
+   Cumulative snapshots have the counts since the beginning. Incremental
+   snapshots have only the instructions executed since the previous one,
+   kept as copies of the instructions with the counts of the period.
+*/
+
+#define PERIOD_POOL_SIZE 16384
+#define PERIOD_PER_SLAB 4096
+
+static Int snapshots = 0;
+static ULong last_blocks = 0;
+static UInt last_time = 0;
+
+static AddrHash* period_instrs = 0; // UniqueInstr* -> UniqueInstr* (copy)
+static Slab* period_slab = 0;
+
+void IGD_(init_snapshots)() {
+	IGD_ASSERT(period_instrs == 0);
+
+	snapshots = 0;
+	last_blocks = 0;
+	last_time = VG_(read_millisecond_timer)();
+
+	if (IGD_(clo).dump_incremental) {
+		period_instrs = IGD_(new_addr_hash)(PERIOD_POOL_SIZE);
+		period_slab = IGD_(new_slab)("igd.snapshot.is.1", sizeof(UniqueInstr), PERIOD_PER_SLAB);
+	}
+}
+
+void IGD_(destroy_snapshots)() {
+	if (period_instrs) {
+		IGD_(addr_hash_clear)(period_instrs, 0);
+		IGD_(delete_addr_hash)(period_instrs);
+		period_instrs = 0;
+
+		IGD_(delete_slab)(period_slab);
+		period_slab = 0;
+	}
+}
+
+Bool IGD_(snapshots_enabled)(void) {
+	return IGD_(clo).instrs_outfile &&
+			(IGD_(clo).dump_every_bb > 0 || IGD_(clo).dump_interval > 0);
+}
+
+// Called when a thread starts running, with the superblocks executed so far.
+void IGD_(check_snapshot)(ULong blocks_done) {
+	UInt now;
+
+	if (IGD_(clo).dump_every_bb > 0 &&
+			(blocks_done - last_blocks) >= (ULong) IGD_(clo).dump_every_bb) {
+		last_blocks = blocks_done;
+		IGD_(take_snapshot)();
+	} else if (IGD_(clo).dump_interval > 0) {
+		now = VG_(read_millisecond_timer)();
+		if ((now - last_time) >= (UInt) IGD_(clo).dump_interval) {
+			last_time = now;
+			IGD_(take_snapshot)();
+		}
+	}
+}
+
+// Record the execution count of the group for the incremental snapshot,
+// before it is flushed to its instructions.
+void IGD_(snapshot_group)(InstrGroup* group) {
+	UInt i;
+	UniqueInstr* instr;
+	UniqueInstr* copy;
+
+	if (!period_instrs || group->exec_count == 0)
+		return;
+
+	IGD_(materialize_group)(group);
+
+	for (i = 0; i < group->ninstrs; i++) {
+		instr = group->instrs[i];
+
+		copy = (UniqueInstr*) IGD_(addr_hash_get)(period_instrs, (Addr) instr);
+		if (!copy) {
+			copy = (UniqueInstr*) IGD_(slab_alloc)(period_slab);
+			*copy = *instr;
+			copy->exec_count = 0;
+
+			IGD_(addr_hash_put)(period_instrs, (Addr) instr, copy);
+		}
+
+		copy->exec_count += group->exec_count;
+	}
+}
+
+static
+Bool collect_copy(UniqueInstr* copy, UniqueInstr*** next) {
+	*((*next)++) = copy;
+	return False;
+}
+
+static
+void release_copy(UniqueInstr* copy) {
+	IGD_(slab_free)(period_slab, copy);
+}
+
+static
+void dump_period(const HChar* filename) {
+	Int count;
+	UniqueInstr** instrs;
+	UniqueInstr** next;
+
+	count = IGD_(addr_hash_count)(period_instrs);
+	instrs = (UniqueInstr**) IGD_MALLOC("igd.snapshot.dp.1",
+						((count + 1) * sizeof(UniqueInstr*)));
+
+	next = instrs;
+	IGD_(addr_hash_forall)(period_instrs, (Bool (*)(void*, void*)) collect_copy, &next);
+	IGD_ASSERT((next - instrs) == count);
+
+	IGD_(dump_instrs_list)(filename, instrs, count);
+
+	IGD_FREE(instrs);
+	IGD_(addr_hash_clear)(period_instrs, (void (*)(void*)) release_copy);
+}
+
+// Drop the counts of the current period.
+void IGD_(zero_snapshots)(void) {
+	if (period_instrs)
+		IGD_(addr_hash_clear)(period_instrs, (void (*)(void*)) release_copy);
+}
+
+void IGD_(take_snapshot)(void) {
+	HChar* name;
+	HChar* filename;
+
+	IGD_ASSERT(IGD_(clo).instrs_outfile != 0);
+
+	IGD_(flush_touched_blocks)();
+
+	// Expanded every time, the pid changes in forked children.
+	filename = VG_(expand_file_name)("--instrs-outfile", IGD_(clo).instrs_outfile);
+	name = (HChar*) IGD_MALLOC("igd.snapshot.ts.1", VG_(strlen)(filename) + 16);
+	VG_(sprintf)(name, "%s.%d", filename, ++snapshots);
+	IGD_FREE(filename);
+
+	if (IGD_(clo).dump_incremental)
+		dump_period(name);
+	else
+		IGD_(dump_instrs)(name);
+
+	IGD_FREE(name);
+}
@@ -0,0 +1,292 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                    summary.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Summary of the counts, written at the end of the run (--summary=yes or
+   --summary-outfile): the total of instructions executed, the hottest
+   instructions and functions (--summary-top), and a histogram of the
+   execution counts of the instructions by powers of two. It answers the
+   common questions without going through the whole instructions file.
+
+   The hottest instructions are selected in a single pass over the pool,
+   with a heap of the top ones seen so far (the least executed at the
+   root), so only the selected ones are sorted.
+*/
+
+#define HISTOGRAM_BUCKETS 64
+
+typedef struct _SummaryScan	SummaryScan;
+struct _SummaryScan {
+	UniqueInstr** heap; // Min-heap by execution count.
+	Int size;
+	Int max;
+	ULong total;        // Instructions executed.
+	ULong executed;     // Distinct instructions executed.
+	ULong buckets[HISTOGRAM_BUCKETS];
+	ULong bucket_counts[HISTOGRAM_BUCKETS];
+};
+
+static VgFile* summary_fp = 0; // Null for the user messages (stderr).
+
+static __attribute__((format(printf, 1, 2)))
+void summary_printf(const HChar* format, ...) {
+	va_list vargs;
+
+	va_start(vargs, format);
+	if (summary_fp)
+		VG_(vfprintf)(summary_fp, format, vargs);
+	else
+		VG_(vmessage)(Vg_UserMsg, format, vargs);
+	va_end(vargs);
+}
+
+static
+void sift_down(UniqueInstr** heap, Int size, Int pos) {
+	Int child;
+	UniqueInstr* tmp;
+
+	while ((child = (2 * pos) + 1) < size) {
+		if ((child + 1) < size &&
+				heap[child + 1]->exec_count < heap[child]->exec_count)
+			child++;
+
+		if (heap[pos]->exec_count <= heap[child]->exec_count)
+			break;
+
+		tmp = heap[pos];
+		heap[pos] = heap[child];
+		heap[child] = tmp;
+
+		pos = child;
+	}
+}
+
+static
+void sift_up(UniqueInstr** heap, Int pos) {
+	Int parent;
+	UniqueInstr* tmp;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (heap[parent]->exec_count <= heap[pos]->exec_count)
+			break;
+
+		tmp = heap[pos];
+		heap[pos] = heap[parent];
+		heap[parent] = tmp;
+
+		pos = parent;
+	}
+}
+
+static
+Int log2_bucket(ULong count) {
+	Int b;
+
+	b = 0;
+	while (count > 1) {
+		count >>= 1;
+		b++;
+	}
+
+	return b;
+}
+
+static
+Bool scan_instr(UniqueInstr* instr, SummaryScan* scan) {
+	Int b;
+
+	if (instr->exec_count == 0)
+		return False;
+
+	scan->total += instr->exec_count;
+	scan->executed++;
+
+	b = log2_bucket(instr->exec_count);
+	scan->buckets[b]++;
+	scan->bucket_counts[b] += instr->exec_count;
+
+	if (scan->size < scan->max) {
+		scan->heap[scan->size] = instr;
+		sift_up(scan->heap, scan->size++);
+	} else if (scan->max > 0 && instr->exec_count > scan->heap[0]->exec_count) {
+		scan->heap[0] = instr;
+		sift_down(scan->heap, scan->size, 0);
+	}
+
+	return False;
+}
+
+static
+Int cmp_hottest(const void* p1, const void* p2) {
+	const UniqueInstr* i1 = *((const UniqueInstr* const*) p1);
+	const UniqueInstr* i2 = *((const UniqueInstr* const*) p2);
+
+	if (i1->exec_count != i2->exec_count)
+		return i1->exec_count > i2->exec_count ? -1 : 1;
+
+	return IGD_(cmp_instrs_addr)(p1, p2);
+}
+
+// The percentage of part in total, with one decimal, as "12.3".
+static
+const HChar* percent(ULong part, ULong total, HChar* buf) {
+	ULong tenths;
+
+	tenths = total ? ((part * 1000) + (total / 2)) / total : 0;
+	VG_(sprintf)(buf, "%llu.%llu", tenths / 10, tenths % 10);
+
+	return buf;
+}
+
+static
+void print_top_instrs(SummaryScan* scan) {
+	Int i;
+	ULong cumulative;
+	DiEpoch ep;
+	const HChar* name;
+	UniqueInstr* instr;
+	HChar pct[32], cum[32];
+
+	VG_(ssort)(scan->heap, scan->size, sizeof(UniqueInstr*), cmp_hottest);
+
+	summary_printf("\n");
+	summary_printf("Top %d instructions:\n", scan->size);
+	summary_printf("  %20s %6s %6s  %-18s %s\n", "count", "%", "cum%", "address", "function");
+
+	ep = VG_(current_DiEpoch)();
+	cumulative = 0;
+	for (i = 0; i < scan->size; i++) {
+		instr = scan->heap[i];
+		cumulative += instr->exec_count;
+
+		if (!VG_(get_fnname)(ep, instr->addr, &name))
+			name = "???";
+
+		summary_printf("  %'20llu %6s %6s  0x%-16lx %s\n", instr->exec_count,
+			percent(instr->exec_count, scan->total, pct),
+			percent(cumulative, scan->total, cum), instr->addr, name);
+	}
+}
+
+static
+void print_top_funcs(Int top, ULong total) {
+	Int i, count;
+	ULong cumulative;
+	ProfileStat* stats;
+	HChar pct[32], cum[32];
+
+	stats = IGD_(func_profiles)(&count);
+	if (count == 0) {
+		IGD_(delete_profiles)(stats, count);
+		return;
+	}
+
+	if (count < top)
+		top = count;
+
+	summary_printf("\n");
+	summary_printf("Top %d functions:\n", top);
+	summary_printf("  %20s %6s %6s %10s  %s\n", "count", "%", "cum%", "instrs", "function");
+
+	cumulative = 0;
+	for (i = 0; i < top; i++) {
+		cumulative += stats[i].count;
+
+		summary_printf("  %'20llu %6s %6s %'10llu  %s\n", stats[i].count,
+			percent(stats[i].count, total, pct), percent(cumulative, total, cum),
+			stats[i].ninstrs, stats[i].name);
+	}
+
+	IGD_(delete_profiles)(stats, count);
+}
+
+static
+void print_histogram(SummaryScan* scan) {
+	Int b;
+	HChar pct[32], cpct[32];
+
+	summary_printf("\n");
+	summary_printf("Execution counts histogram:\n");
+	summary_printf("  %-22s %14s %6s %20s %6s\n", "count range", "instrs", "%",
+		"executed", "%");
+
+	for (b = 0; b < HISTOGRAM_BUCKETS; b++) {
+		HChar range[48];
+
+		if (scan->buckets[b] == 0)
+			continue;
+
+		if (b == (HISTOGRAM_BUCKETS - 1))
+			VG_(sprintf)(range, "[2^%d, ...)", b);
+		else
+			VG_(sprintf)(range, "[%llu, %llu)", 1ULL << b, 1ULL << (b + 1));
+
+		summary_printf("  %-22s %'14llu %6s %'20llu %6s\n", range, scan->buckets[b],
+			percent(scan->buckets[b], scan->executed, pct), scan->bucket_counts[b],
+			percent(scan->bucket_counts[b], scan->total, cpct));
+	}
+}
+
+// Write the summary. The groups must be flushed already.
+void IGD_(write_summary)(const HChar* filename) {
+	SummaryScan scan;
+
+	if (filename) {
+		summary_fp = VG_(fopen)(filename, VKI_O_CREAT|VKI_O_WRONLY|VKI_O_TRUNC,
+									VKI_S_IRUSR|VKI_S_IWUSR);
+		IGD_ASSERT(summary_fp != 0);
+	}
+
+	VG_(memset)(&scan, 0, sizeof(scan));
+	scan.max = IGD_(clo).summary_top;
+	scan.heap = (UniqueInstr**) IGD_MALLOC("igd.summary.ws.1",
+						((scan.max + 1) * sizeof(UniqueInstr*)));
+
+	IGD_(forall_instrs)((Bool (*)(UniqueInstr*, void*)) scan_instr, &scan);
+
+	summary_printf("Instructions executed: %'llu (%'llu distinct, %'d instrumented)\n",
+		scan.total, scan.executed, IGD_(instrs_count)());
+
+	if (scan.max > 0) {
+		print_top_instrs(&scan);
+		print_top_funcs(scan.max, scan.total);
+	}
+
+	if (scan.executed > 0)
+		print_histogram(&scan);
+
+	IGD_FREE(scan.heap);
+
+	if (summary_fp) {
+		VG_(fclose)(summary_fp);
+		summary_fp = 0;
+	}
+}
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// Branch heavy loop: most iterations leave the superblocks by a side exit.
+unsigned classify(unsigned x) {
+  unsigned r = 0;
+
+  if (x & 1)
+    r += 3;
+  if (x & 2)
+    r ^= x;
+  if (x & 4)
+    r += x >> 3;
+  if (x & 8)
+    r -= 7;
+  if (x % 3 == 0)
+    r *= 5;
+  if (x % 5 == 0)
+    r += 11;
+
+  return r;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned i, n, x, sum;
+
+  n = argc > 1 ? atoi(argv[1]) : 10000000;
+
+  x = 12345;
+  sum = 0;
+  for (i = 0; i < n; i++) {
+    x = x * 1103515245 + 12345;
+    sum += classify(x >> 8);
+  }
+
+  printf("%u\n", sum);
+
+  return 0;
+}
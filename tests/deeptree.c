@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// Deep branching: a full binary recursion where every level branches on
+// the data. The leaf function is called 2^depth times per round.
+__attribute__((noinline))
+unsigned leaf(unsigned x) {
+  return x ^ (x >> 7);
+}
+
+__attribute__((noinline))
+unsigned walk(int depth, unsigned x) {
+  unsigned r;
+
+  if (depth == 0)
+    return leaf(x);
+
+  if (x & 1)
+    r = walk(depth - 1, x * 3 + 1) + walk(depth - 1, x >> 1);
+  else if (x & 2)
+    r = walk(depth - 1, x + 7) ^ walk(depth - 1, x * 5);
+  else
+    r = walk(depth - 1, x >> 2) - walk(depth - 1, x + depth);
+
+  return r;
+}
+
+int main(int argc, char* argv[]) {
+  int depth, rounds, i;
+  unsigned sum;
+
+  depth = argc > 1 ? atoi(argv[1]) : 20;
+  rounds = argc > 2 ? atoi(argv[2]) : 1;
+
+  sum = 0;
+  for (i = 0; i < rounds; i++)
+    sum += walk(depth, 12345 + i);
+
+  printf("%u\n", sum);
+
+  return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# Compare the counting schemes on a branch heavy client: the number of
+# counter increments executed (from --stats=yes) and the wall time.
+#
+#   $ gcc -O2 branchy.c -o branchy
+#   $ ./exitbench.sh ./branchy 10000000
+#
+# Each scheme is run with every --counter-mode, or only the ones listed
+# in MODES, and with the shared and the per thread counters
+# (--separate-threads), or only the ones listed in THREADS, to measure the
+# overhead of loading the counters of the running thread.
+
+VALGRIND=${VALGRIND:-valgrind}
+MODES=${MODES:-inline call guarded}
+THREADS=${THREADS:-no yes}
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <client> [args...]" >&2
+	exit 1
+fi
+
+for mode in $MODES; do
+	for threads in $THREADS; do
+		for exits in no yes; do
+			start=$(date +%s.%N)
+			incs=$($VALGRIND -q --tool=instrgrind --stats=yes --exit-counters=$exits \
+				--counter-mode=$mode --separate-threads=$threads "$@" 2>&1 >/dev/null |
+				sed -n 's/.*blocks: \(.*\) counter increments.*/\1/p')
+			end=$(date +%s.%N)
+
+			printf "counter-mode=%-7s  separate-threads=%-3s  exit-counters=%-3s  increments %15s  time %6.2fs\n" \
+				$mode $threads $exits "$incs" $(awk "BEGIN { print $end - $start }")
+		done
+	done
+done
@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# Generate a client with a large code footprint: <n> functions, each with
+# a few branches, all called once per round by main.
+#
+#   $ ./genbig.sh 5000 > bigcode.c
+
+n=${1:-5000}
+
+cat <<HEADER
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef unsigned (*fn_t)(unsigned);
+
+HEADER
+
+i=0
+while [ $i -lt $n ]; do
+	cat <<FUNC
+__attribute__((noinline))
+unsigned f$i(unsigned x) {
+  if (x & $(( (i % 7) + 1 )))
+    x = x * $(( i * 2 + 3 )) + $i;
+  else
+    x ^= x >> $(( (i % 13) + 1 ));
+  switch (x % 4) {
+    case 0: return x + $i;
+    case 1: return x ^ $(( i * 7 ));
+    case 2: return x - $(( i % 251 ));
+    default: return x;
+  }
+}
+
+FUNC
+	i=$((i + 1))
+done
+
+echo "static const fn_t fns[] = {"
+i=0
+while [ $i -lt $n ]; do
+	echo "  f$i,"
+	i=$((i + 1))
+done
+echo "};"
+
+cat <<MAIN
+
+int main(int argc, char* argv[]) {
+  int rounds, r, i;
+  unsigned x;
+
+  rounds = argc > 1 ? atoi(argv[1]) : 1;
+
+  x = 1;
+  for (r = 0; r < rounds; r++) {
+    for (i = 0; i < $n; i++)
+      x = fns[i](x);
+  }
+
+  printf("%u\n", x);
+
+  return 0;
+}
+MAIN
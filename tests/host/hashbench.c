@@ -0,0 +1,193 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                       tests/host/hashbench.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+   Compare the instructions pool containers outside valgrind: the
+   chained SmartHash (smarthash.c) against the open addressing AddrHash
+   (addrhash.c), using instruction like keys (ascending addresses with
+   1 to 15 bytes gaps, inserted in superblock sized runs).
+
+   Usage: hashbench [ninstrs ...]
+*/
+
+#include <time.h>
+
+#include "global.h"
+
+SizeT igd_host_cur_bytes = 0;
+SizeT igd_host_peak_bytes = 0;
+
+static
+Double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static
+HWord instr_key(void* value) {
+	return ((UniqueInstr*) value)->addr;
+}
+
+static
+UniqueInstr* make_instrs(Int count) {
+	Int i, j, runs;
+	Addr addr;
+	UniqueInstr* instrs;
+	UniqueInstr tmp;
+
+	instrs = (UniqueInstr*) calloc(count, sizeof(UniqueInstr));
+	assert(instrs != 0);
+
+	addr = 0x400000;
+	for (i = 0; i < count; i++) {
+		instrs[i].size = 1 + (rand() % 15);
+		instrs[i].addr = addr;
+		addr += instrs[i].size;
+	}
+
+	// Shuffle runs of up to 32 instructions, like superblocks being
+	// translated in execution order.
+	runs = count / 32;
+	for (i = runs - 1; i > 0; i--) {
+		Int r = rand() % (i + 1);
+		for (j = 0; j < 32; j++) {
+			tmp = instrs[(i * 32) + j];
+			instrs[(i * 32) + j] = instrs[(r * 32) + j];
+			instrs[(r * 32) + j] = tmp;
+		}
+	}
+
+	return instrs;
+}
+
+static
+void bench_smart_hash(UniqueInstr* instrs, Int count) {
+	Int i, found;
+	Double t0, t1, t2, t3;
+	SizeT base;
+	SmartHash* shash;
+
+	base = igd_host_cur_bytes;
+	igd_host_peak_bytes = base;
+
+	t0 = now();
+	// Same setup as the original instructions pool.
+	shash = IGD_(new_smart_hash)(262144);
+	IGD_(smart_hash_set_growth_rate)(shash, 1.5f);
+	for (i = 0; i < count; i++)
+		IGD_(smart_hash_put)(shash, &(instrs[i]), instr_key);
+
+	t1 = now();
+	found = 0;
+	for (i = count - 1; i >= 0; i--)
+		found += IGD_(smart_hash_get)(shash, instrs[i].addr, instr_key) != 0;
+	assert(found == count);
+
+	t2 = now();
+	found = 0;
+	for (i = 0; i < count; i++)
+		found += IGD_(smart_hash_get)(shash, instrs[i].addr + 0x10000000, instr_key) != 0;
+	assert(found == 0);
+
+	t3 = now();
+	printf("  smarthash: put %7.2f Mops/s  get %7.2f Mops/s  miss %7.2f Mops/s  mem %8.2f MB\n",
+		count / (t1 - t0) / 1e6, count / (t2 - t1) / 1e6, count / (t3 - t2) / 1e6,
+		(igd_host_peak_bytes - base) / 1048576.0);
+
+	IGD_(smart_hash_clear)(shash, 0);
+	IGD_(delete_smart_hash)(shash);
+}
+
+static
+void bench_addr_hash(UniqueInstr* instrs, Int count) {
+	Int i, found;
+	Double t0, t1, t2, t3;
+	SizeT base;
+	AddrHash* ahash;
+
+	base = igd_host_cur_bytes;
+	igd_host_peak_bytes = base;
+
+	t0 = now();
+	ahash = IGD_(new_addr_hash)(262144);
+	for (i = 0; i < count; i++)
+		IGD_(addr_hash_put)(ahash, instrs[i].addr, &(instrs[i]));
+
+	t1 = now();
+	found = 0;
+	for (i = count - 1; i >= 0; i--)
+		found += IGD_(addr_hash_get)(ahash, instrs[i].addr) == &(instrs[i]);
+	assert(found == count);
+
+	t2 = now();
+	found = 0;
+	for (i = 0; i < count; i++)
+		found += IGD_(addr_hash_get)(ahash, instrs[i].addr + 0x10000000) != 0;
+	assert(found == 0);
+
+	t3 = now();
+	printf("  addrhash:  put %7.2f Mops/s  get %7.2f Mops/s  miss %7.2f Mops/s  mem %8.2f MB\n",
+		count / (t1 - t0) / 1e6, count / (t2 - t1) / 1e6, count / (t3 - t2) / 1e6,
+		(igd_host_peak_bytes - base) / 1048576.0);
+
+	// Exercise the removal paths and check the survivors.
+	for (i = 0; i < count; i += 2)
+		assert(IGD_(addr_hash_remove)(ahash, instrs[i].addr) == &(instrs[i]));
+	for (i = 0; i < count; i++)
+		assert(IGD_(addr_hash_get)(ahash, instrs[i].addr) == ((i % 2) ? &(instrs[i]) : 0));
+	assert(IGD_(addr_hash_count)(ahash) == count / 2);
+
+	IGD_(addr_hash_clear)(ahash, 0);
+	IGD_(delete_addr_hash)(ahash);
+}
+
+int main(int argc, char* argv[]) {
+	Int i, count;
+	static const Int defaults[] = { 100000, 1000000, 4000000 };
+	UniqueInstr* instrs;
+
+	srand(42);
+
+	for (i = 0; i < (argc > 1 ? argc - 1 : 3); i++) {
+		count = argc > 1 ? atoi(argv[i + 1]) : defaults[i];
+		if (count <= 0)
+			continue;
+
+		instrs = make_instrs(count);
+
+		printf("%d instructions:\n", count);
+		bench_smart_hash(instrs, count);
+		bench_addr_hash(instrs, count);
+
+		free(instrs);
+	}
+
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                 tests/host/pub_tool_basics.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+   A thin shim of the valgrind tool interface over the host libc, so the
+   tool modules that do not depend on the core (containers and file
+   formats) can be built and exercised as plain host programs. All the
+   other pub_tool_*.h headers in this directory just include this one.
+*/
+
+#ifndef IGD_HOST_SHIM
+#define IGD_HOST_SHIM
+
+#include <assert.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+typedef unsigned char		UChar;
+typedef signed char		Char;
+typedef char			HChar;
+typedef unsigned short		UShort;
+typedef signed short		Short;
+typedef unsigned int		UInt;
+typedef signed int		Int;
+typedef unsigned long long	ULong;
+typedef signed long long	Long;
+typedef unsigned long		UWord;
+typedef signed long		Word;
+typedef unsigned long		HWord;
+typedef unsigned long		Addr;
+typedef unsigned long		SizeT;
+typedef signed long		SSizeT;
+typedef signed long		PtrdiffT;
+typedef unsigned char		Bool;
+typedef float			Float;
+typedef double			Double;
+typedef UInt			ThreadId;
+
+#define True  ((Bool)1)
+#define False ((Bool)0)
+
+#define VG_WORDSIZE		__SIZEOF_POINTER__
+#define VG_REGPARM(n)
+#define VGAPPEND(str1,str2)	str1##str2
+#define VG_(str)		VGAPPEND(vgPlain_,str)
+
+typedef FILE			VgFile;
+
+/* Allocation accounting, so the benchmarks can report memory usage.
+   Atomic, since igd_merge allocates from several threads. */
+extern SizeT igd_host_cur_bytes;
+extern SizeT igd_host_peak_bytes;
+
+static __inline__
+void* vgPlain_malloc(const HChar* cc, SizeT n) {
+	SizeT cur, peak;
+	SizeT* p = (SizeT*) malloc(n + sizeof(SizeT));
+	assert(p != 0);
+	(void) cc;
+
+	*p = n;
+	cur = __atomic_add_fetch(&igd_host_cur_bytes, n, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&igd_host_peak_bytes, __ATOMIC_RELAXED);
+	while (cur > peak && !__atomic_compare_exchange_n(&igd_host_peak_bytes,
+			&peak, cur, True, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	return p + 1;
+}
+
+static __inline__
+void vgPlain_free(void* ptr) {
+	SizeT* p;
+
+	if (!ptr)
+		return;
+
+	p = ((SizeT*) ptr) - 1;
+	__atomic_sub_fetch(&igd_host_cur_bytes, *p, __ATOMIC_RELAXED);
+	free(p);
+}
+
+static __inline__
+void* vgPlain_realloc(const HChar* cc, void* ptr, SizeT n) {
+	void* np = vgPlain_malloc(cc, n);
+
+	if (ptr) {
+		SizeT old = ((SizeT*) ptr)[-1];
+		memcpy(np, ptr, old < n ? old : n);
+		vgPlain_free(ptr);
+	}
+
+	return np;
+}
+
+static __inline__
+HChar* vgPlain_strdup(const HChar* cc, const HChar* s) {
+	HChar* d = (HChar*) vgPlain_malloc(cc, strlen(s) + 1);
+	return strcpy(d, s);
+}
+
+#define vgPlain_memset		memset
+#define vgPlain_memcpy		memcpy
+#define vgPlain_memmove		memmove
+#define vgPlain_memcmp		memcmp
+#define vgPlain_strlen		strlen
+#define vgPlain_strcmp		strcmp
+#define vgPlain_strncmp		strncmp
+#define vgPlain_strcpy		strcpy
+#define vgPlain_strchr		strchr
+#define vgPlain_strrchr		strrchr
+#define vgPlain_tolower		tolower
+#define vgPlain_ssort		qsort
+#define vgPlain_printf		printf
+#define vgPlain_fprintf		fprintf
+#define vgPlain_sprintf		sprintf
+#define vgPlain_snprintf	snprintf
+#define vgPlain_umsg(...)	fprintf(stderr, __VA_ARGS__)
+#define vgPlain_strtoull10(s,e)	strtoull((s),(e),10)
+#define vgPlain_strtoull16(s,e)	strtoull((s),(e),16)
+
+#define vgPlain_fd_open(f,fl,m)	open((f),(fl),(m))
+#define vgPlain_close		close
+#define vgPlain_read		read
+#define vgPlain_write		write
+#define vgPlain_lseek		lseek
+
+#define VKI_O_RDONLY		O_RDONLY
+#define VKI_O_WRONLY		O_WRONLY
+#define VKI_O_RDWR		O_RDWR
+#define VKI_O_CREAT		O_CREAT
+#define VKI_O_TRUNC		O_TRUNC
+#define VKI_S_IRUSR		S_IRUSR
+#define VKI_S_IWUSR		S_IWUSR
+#define VKI_SEEK_SET		SEEK_SET
+
+static __inline__ __attribute__((noreturn))
+void vgPlain_tool_panic(const HChar* str) {
+	fprintf(stderr, "panic: %s\n", str);
+	abort();
+}
+
+#define tl_assert(expr)		assert(expr)
+
+#endif
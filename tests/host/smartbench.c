@@ -0,0 +1,467 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                      tests/host/smartbench.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/*
+   Check and benchmark the SmartList (smartlist.c) and SmartHash
+   (smarthash.c) containers outside valgrind. The containers are first
+   validated against plain arrays, for several initial sizes and growth
+   rates, and then their throughput and peak memory are measured.
+
+   The variants are chosen when building: -DSMART_LIST_MODE=1 for the
+   chained lists (2, the realloc lists, by default) and -DTRACKING_CELLS
+   for the hash tables that track their used cells.
+
+   Usage: smartbench [nelems ...]
+*/
+
+#include <time.h>
+
+#include "global.h"
+
+SizeT igd_host_cur_bytes = 0;
+SizeT igd_host_peak_bytes = 0;
+
+typedef struct {
+	HWord key;
+	Int mark;
+} Item;
+
+static const Float growth_rates[] = { 1.5f, 2.0f, 4.0f };
+#define NRATES ((Int) (sizeof(growth_rates) / sizeof(growth_rates[0])))
+
+static
+Double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static
+HWord item_key(void* value) {
+	return ((Item*) value)->key;
+}
+
+// Instruction like keys: ascending addresses with 1 to 15 bytes gaps,
+// shuffled.
+static
+Item* make_items(Int count) {
+	Int i, r;
+	HWord addr;
+	Item* items;
+	Item tmp;
+
+	items = (Item*) calloc(count, sizeof(Item));
+	assert(items != 0);
+
+	addr = 0x400000;
+	for (i = 0; i < count; i++) {
+		addr += 1 + (rand() % 15);
+		items[i].key = addr;
+	}
+
+	for (i = count - 1; i > 0; i--) {
+		r = rand() % (i + 1);
+		tmp = items[i];
+		items[i] = items[r];
+		items[r] = tmp;
+	}
+
+	return items;
+}
+
+/* ------------------------------------------------------------------ */
+/* Validation                                                         */
+/* ------------------------------------------------------------------ */
+
+static
+Bool mark_item(void* value, void* arg) {
+	((Item*) value)->mark++;
+	*((Int*) arg) += 1;
+	return False;
+}
+
+static
+Bool remove_odd(void* value, void* arg) {
+	IGD_UNUSED(arg);
+	return (((Item*) value)->key & 1) != 0;
+}
+
+static
+Bool same_item(void* v1, void* v2) {
+	return v1 == v2;
+}
+
+static
+Bool key_even(void* value, void* arg) {
+	IGD_UNUSED(arg);
+	return (((Item*) value)->key & 1) == 0;
+}
+
+static
+void clear_marks(Item* items, Int count) {
+	Int i;
+
+	for (i = 0; i < count; i++)
+		items[i].mark = 0;
+}
+
+static
+void check_smart_list(Item* items, Int count, Int size, Float rate) {
+	Int i, visited, expected;
+	SmartList* slist;
+	SmartList* clone;
+	SmartList* copy;
+	SmartSeek* ss;
+	SmartValue* found;
+	SmartValue* sv;
+
+	slist = IGD_(new_smart_list)(size);
+	IGD_(smart_list_set_growth_rate)(slist, rate);
+
+	// Add and read back.
+	for (i = 0; i < count; i++)
+		IGD_(smart_list_add)(slist, &(items[i]));
+	assert(IGD_(smart_list_count)(slist) == count);
+	assert(IGD_(smart_list_size)(slist) >= count);
+	for (i = 0; i < count; i++)
+		assert(IGD_(smart_list_at)(slist, i) == &(items[i]));
+	assert(IGD_(smart_list_at)(slist, IGD_(smart_list_size)(slist)) == 0);
+	assert(IGD_(smart_list_head)(slist) == &(items[0]));
+	assert(IGD_(smart_list_tail)(slist) == &(items[count - 1]));
+
+	// Every element is visited once.
+	clear_marks(items, count);
+	visited = 0;
+	IGD_(smart_list_forall)(slist, mark_item, &visited);
+	assert(visited == count);
+	for (i = 0; i < count; i++)
+		assert(items[i].mark == 1);
+
+	// The seek visits the same elements in order.
+	ss = IGD_(smart_list_seek)(slist);
+	for (i = 0; IGD_(smart_list_has_next)(ss); i++) {
+		assert(IGD_(smart_list_get_index)(ss) == i);
+		assert(IGD_(smart_list_get_value)(ss) == &(items[i]));
+		IGD_(smart_list_next)(ss);
+	}
+	assert(i == count);
+
+	IGD_(smart_list_set_index)(ss, count / 2);
+	assert(IGD_(smart_list_get_value)(ss) == &(items[count / 2]));
+	IGD_(smart_list_delete_seek)(ss);
+
+	// Find the elements with even keys.
+	expected = 0;
+	for (i = 0; i < count; i++)
+		expected += (items[i].key & 1) == 0;
+
+	found = IGD_(smart_list_find)(slist, key_even, 0);
+	for (sv = found, i = 0; sv; sv = sv->next, i++) {
+		assert(sv->value == IGD_(smart_list_at)(slist, sv->index));
+		assert((((Item*) sv->value)->key & 1) == 0);
+	}
+	assert(i == expected);
+	if (found)
+		IGD_(smart_list_delete_value)(found);
+
+	// Clones and copies have the same elements.
+	clone = IGD_(clone_smart_list)(slist);
+	copy = IGD_(new_smart_list)(size);
+	IGD_(smart_list_copy)(copy, slist);
+	for (i = 0; i < count; i++) {
+		assert(IGD_(smart_list_at)(clone, i) == &(items[i]));
+		assert(IGD_(smart_list_at)(copy, i) == &(items[i]));
+	}
+	assert(IGD_(smart_list_count)(clone) == count);
+	assert(IGD_(smart_list_count)(copy) == count);
+
+	IGD_(smart_list_clear)(clone, 0);
+	IGD_(delete_smart_list)(clone);
+	IGD_(smart_list_clear)(copy, 0);
+	IGD_(delete_smart_list)(copy);
+
+	// Remove the odd keys while visiting, and set and delete slots.
+	IGD_(smart_list_forall)(slist, remove_odd, 0);
+	assert(IGD_(smart_list_count)(slist) == expected);
+	for (i = 0; i < count; i++) {
+		assert(IGD_(smart_list_at)(slist, i) ==
+			((items[i].key & 1) ? 0 : &(items[i])));
+		assert(IGD_(smart_list_contains)(slist, &(items[i]), same_item) ==
+			((items[i].key & 1) == 0));
+	}
+
+	for (i = 0; i < count; i++)
+		IGD_(smart_list_set)(slist, i, &(items[i]));
+	assert(IGD_(smart_list_count)(slist) == count);
+
+	for (i = 0; i < count; i += 3)
+		IGD_(smart_list_del)(slist, i, False);
+	assert(IGD_(smart_list_count)(slist) == count - ((count + 2) / 3));
+
+	// Setting beyond the size grows the list.
+	IGD_(smart_list_set)(slist, IGD_(smart_list_size)(slist) + 5, &(items[0]));
+	assert(IGD_(smart_list_count)(slist) == count - ((count + 2) / 3) + 1);
+
+	IGD_(smart_list_clear)(slist, 0);
+	assert(IGD_(smart_list_is_empty)(slist));
+	IGD_(delete_smart_list)(slist);
+}
+
+static
+void check_smart_hash(Item* items, Int count, Int size, Float rate) {
+	Int i, visited, odd;
+	Item other;
+	SmartHash* shash;
+	SmartHash* dst;
+
+	shash = IGD_(new_smart_hash)(size);
+	IGD_(smart_hash_set_growth_rate)(shash, rate);
+
+	for (i = 0; i < count; i++)
+		assert(IGD_(smart_hash_put)(shash, &(items[i]), item_key) == 0);
+	assert(IGD_(smart_hash_count)(shash) == count);
+
+	for (i = 0; i < count; i++) {
+		assert(IGD_(smart_hash_get)(shash, items[i].key, item_key) == &(items[i]));
+		assert(IGD_(smart_hash_get)(shash, items[i].key + 0x10000000, item_key) == 0);
+	}
+
+	// Putting a value with the same key replaces the old one.
+	other = items[0];
+	assert(IGD_(smart_hash_put)(shash, &other, item_key) == &(items[0]));
+	assert(IGD_(smart_hash_get)(shash, items[0].key, item_key) == &other);
+	assert(IGD_(smart_hash_put)(shash, &(items[0]), item_key) == &other);
+	assert(IGD_(smart_hash_count)(shash) == count);
+
+	clear_marks(items, count);
+	visited = 0;
+	IGD_(smart_hash_forall)(shash, mark_item, &visited);
+	assert(visited == count);
+	for (i = 0; i < count; i++)
+		assert(items[i].mark == 1);
+
+	// Remove the odd keys while visiting, then every third one.
+	odd = 0;
+	for (i = 0; i < count; i++)
+		odd += (items[i].key & 1) != 0;
+
+	IGD_(smart_hash_forall)(shash, remove_odd, 0);
+	assert(IGD_(smart_hash_count)(shash) == count - odd);
+	for (i = 0; i < count; i++) {
+		assert(IGD_(smart_hash_contains)(shash, items[i].key, item_key) ==
+			((items[i].key & 1) == 0));
+	}
+
+	for (i = 0; i < count; i++) {
+		if (items[i].key & 1)
+			IGD_(smart_hash_put)(shash, &(items[i]), item_key);
+	}
+	assert(IGD_(smart_hash_count)(shash) == count);
+
+	for (i = 0; i < count; i += 3)
+		assert(IGD_(smart_hash_remove)(shash, items[i].key, item_key) == &(items[i]));
+	for (i = 0; i < count; i += 3)
+		assert(IGD_(smart_hash_remove)(shash, items[i].key, item_key) == 0);
+	assert(IGD_(smart_hash_count)(shash) == count - ((count + 2) / 3));
+
+	// Merging moves all the values.
+	dst = IGD_(new_smart_hash)(size);
+	IGD_(smart_hash_set_growth_rate)(dst, rate);
+	IGD_(smart_hash_merge)(dst, shash, item_key);
+	assert(IGD_(smart_hash_is_empty)(shash));
+	assert(IGD_(smart_hash_count)(dst) == count - ((count + 2) / 3));
+	for (i = 0; i < count; i++) {
+		assert(IGD_(smart_hash_get)(dst, items[i].key, item_key) ==
+			((i % 3) ? &(items[i]) : 0));
+	}
+
+	IGD_(smart_hash_clear)(dst, 0);
+	assert(IGD_(smart_hash_is_empty)(dst));
+	IGD_(delete_smart_hash)(dst);
+	IGD_(delete_smart_hash)(shash);
+}
+
+static
+void check_all(void) {
+	Int i, r, c;
+	static const Int sizes[] = { 1, 7, 64 };
+	static const Int counts[] = { 1, 10, 1000, 20000 };
+	Item* items;
+
+	for (c = 0; c < (Int) (sizeof(counts) / sizeof(counts[0])); c++) {
+		items = make_items(counts[c]);
+
+		for (i = 0; i < (Int) (sizeof(sizes) / sizeof(sizes[0])); i++) {
+			for (r = 0; r < NRATES; r++) {
+				check_smart_list(items, counts[c], sizes[i], growth_rates[r]);
+				check_smart_hash(items, counts[c], sizes[i], growth_rates[r]);
+			}
+		}
+
+		free(items);
+	}
+
+	// Every allocation was released.
+	assert(igd_host_cur_bytes == 0);
+
+	printf("checks passed\n");
+}
+
+/* ------------------------------------------------------------------ */
+/* Benchmarks                                                         */
+/* ------------------------------------------------------------------ */
+
+static
+Bool count_item(void* value, void* arg) {
+	IGD_UNUSED(value);
+	*((Int*) arg) += 1;
+	return False;
+}
+
+static
+void bench_smart_list(Item* items, Int count, Float rate) {
+	Int i, visited;
+	Double t0, t1, t2, t3;
+	SizeT base;
+	HWord sum;
+	SmartList* slist;
+
+	base = igd_host_cur_bytes;
+	igd_host_peak_bytes = base;
+
+	t0 = now();
+	slist = IGD_(new_smart_list)(16);
+	IGD_(smart_list_set_growth_rate)(slist, rate);
+	for (i = 0; i < count; i++)
+		IGD_(smart_list_add)(slist, &(items[i]));
+
+	t1 = now();
+	sum = 0;
+	for (i = 0; i < count; i++)
+		sum += ((Item*) IGD_(smart_list_at)(slist, i))->key;
+
+	t2 = now();
+	visited = 0;
+	IGD_(smart_list_forall)(slist, count_item, &visited);
+	assert(visited == count);
+
+	t3 = now();
+	printf("    list  %.1f: add %7.2f  at %7.2f  forall %7.2f Mops/s  mem %8.2f MB%s\n",
+		rate, count / (t1 - t0) / 1e6, count / (t2 - t1) / 1e6,
+		count / (t3 - t2) / 1e6, (igd_host_peak_bytes - base) / 1048576.0,
+		sum == 0 ? " " : "");
+
+	IGD_(smart_list_clear)(slist, 0);
+	IGD_(delete_smart_list)(slist);
+}
+
+static
+void bench_smart_hash(Item* items, Int count, Float rate) {
+	Int i, visited, half;
+	Double t0, t1, t2, t3, t4, t5;
+	SizeT base;
+	SmartHash* shash;
+	SmartHash* dst;
+
+	base = igd_host_cur_bytes;
+	igd_host_peak_bytes = base;
+
+	t0 = now();
+	shash = IGD_(new_smart_hash)(1024);
+	IGD_(smart_hash_set_growth_rate)(shash, rate);
+	for (i = 0; i < count; i++)
+		IGD_(smart_hash_put)(shash, &(items[i]), item_key);
+
+	t1 = now();
+	for (i = count - 1; i >= 0; i--)
+		assert(IGD_(smart_hash_get)(shash, items[i].key, item_key) != 0);
+
+	t2 = now();
+	visited = 0;
+	IGD_(smart_hash_forall)(shash, count_item, &visited);
+	assert(visited == count);
+
+	t3 = now();
+	half = count / 2;
+	for (i = 0; i < half; i++)
+		assert(IGD_(smart_hash_remove)(shash, items[i].key, item_key) != 0);
+
+	t4 = now();
+	dst = IGD_(new_smart_hash)(1024);
+	IGD_(smart_hash_set_growth_rate)(dst, rate);
+	IGD_(smart_hash_merge)(dst, shash, item_key);
+
+	t5 = now();
+	printf("    hash  %.1f: put %7.2f  get %7.2f  forall %7.2f  remove %7.2f"
+		"  merge %7.2f Mops/s  mem %8.2f MB\n", rate,
+		count / (t1 - t0) / 1e6, count / (t2 - t1) / 1e6, count / (t3 - t2) / 1e6,
+		half / (t4 - t3) / 1e6, (count - half) / (t5 - t4) / 1e6,
+		(igd_host_peak_bytes - base) / 1048576.0);
+
+	IGD_(smart_hash_clear)(dst, 0);
+	IGD_(delete_smart_hash)(dst);
+	IGD_(delete_smart_hash)(shash);
+}
+
+int main(int argc, char* argv[]) {
+	Int i, r, count;
+	static const Int defaults[] = { 10000, 100000, 1000000 };
+	Item* items;
+
+	srand(42);
+
+	printf("SMART_LIST_MODE=%d (%s lists), %s\n", SMART_LIST_MODE,
+		SMART_LIST_MODE == 1 ? "chained" : "realloc",
+#ifdef TRACKING_CELLS
+		"tracking cells"
+#else
+		"no tracking cells"
+#endif
+	);
+
+	check_all();
+
+	for (i = 0; i < (argc > 1 ? argc - 1 : 3); i++) {
+		count = argc > 1 ? atoi(argv[i + 1]) : defaults[i];
+		if (count <= 0)
+			continue;
+
+		items = make_items(count);
+
+		printf("%d elements:\n", count);
+		for (r = 0; r < NRATES; r++) {
+			bench_smart_list(items, count, growth_rates[r]);
+			bench_smart_hash(items, count, growth_rates[r]);
+		}
+
+		free(items);
+	}
+
+	return 0;
+}
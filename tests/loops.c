@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// Long running loops over a small amount of code. The step function is
+// called exactly n times (a golden count of perfsuite.sh).
+__attribute__((noinline))
+unsigned step(unsigned x) {
+  return x * 1103515245 + 12345;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned i, j, n, x, sum;
+
+  n = argc > 1 ? atoi(argv[1]) : 10000000;
+
+  x = 1;
+  sum = 0;
+  for (i = 0; i < n; i++) {
+    x = step(x);
+
+    for (j = 0; j < 8; j++)
+      sum += (x >> j) & 1;
+  }
+
+  printf("%u\n", sum);
+
+  return 0;
+}
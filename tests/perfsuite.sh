@@ -0,0 +1,107 @@
+#!/bin/sh
+#
+# Benchmark and regression suite of the tool. The synthetic clients stress
+# a large code footprint (bigcode, 5000 generated functions, dominated by
+# the translation), deep branching (deeptree, branchy), retranslation
+# (retrans, which stops and starts counting) and long loops (loops). Each
+# client is run under nulgrind and instrgrind, and the suite reports:
+#
+#   none, igd   wall time of the runs, in seconds
+#   slowdown    of instrgrind over nulgrind
+#   transl      superblocks translated by instrgrind (core --stats)
+#   peak        peak memory of the instrgrind run, in MB
+#   dump        time to sort and write the counts, in ms (tool --stats)
+#
+# and checks the counts of the functions listed in perfsuite.exp, so a
+# faster tool is also a correct one. It exits with 1 if a count differs.
+#
+#   $ cd instrgrind/tests
+#   $ ./perfsuite.sh
+#
+# Extra tool options can be given in IGD_OPTS, to compare configurations:
+#
+#   $ IGD_OPTS="--counter-width=32 --lazy-instrs=yes" ./perfsuite.sh
+
+VALGRIND=${VALGRIND:-valgrind}
+CC=${CC:-gcc}
+VALGRIND_INCLUDE=${VALGRIND_INCLUDE:-../../include}
+
+dir=$(cd "$(dirname "$0")" && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# Without PIE the functions are at the addresses of the symbol table, and
+# without inlining each one is entered once per call.
+CFLAGS="-O1 -fno-inline -no-pie -I$dir/.. -I$VALGRIND_INCLUDE"
+
+"$dir/genbig.sh" 5000 > "$tmp/bigcode.c"
+for client in loops deeptree branchy retrans bigcode; do
+	src="$dir/$client.c"
+	[ -f "$src" ] || src="$tmp/$client.c"
+
+	if ! $CC $CFLAGS "$src" -o "$tmp/$client"; then
+		echo "failed to build $client" >&2
+		exit 1
+	fi
+done
+
+seconds() {
+	awk -v s=$1 -v e=$2 'BEGIN { printf "%.2f", e - s }'
+}
+
+# The peak memory needs GNU time.
+TIME=
+[ -x /usr/bin/time ] && TIME="/usr/bin/time -f peak=%M -o $tmp/time.out"
+
+printf "%-10s %-14s %7s %7s %8s %8s %7s %7s  %s\n" \
+	client args none igd slowdown transl peak dump golden
+
+grep -v '^#' "$dir/perfsuite.exp" | while read client a1 a2 rest; do
+	[ -n "$client" ] || continue
+
+	# One or two arguments, then the function and the count.
+	set -- $a1 $a2 $rest
+	if [ $# -eq 4 ]; then
+		args="$1 $2"; fn=$3; expected=$4
+	else
+		args="$1"; fn=$2; expected=$3
+	fi
+
+	start=$(date +%s.%N)
+	$VALGRIND -q --tool=none "$tmp/$client" $args >/dev/null 2>&1
+	end=$(date +%s.%N)
+	none=$(seconds $start $end)
+
+	start=$(date +%s.%N)
+	rm -f "$tmp/time.out"
+	$TIME $VALGRIND --tool=instrgrind --stats=yes $IGD_OPTS \
+			--instrs-outfile="$tmp/$client.out" "$tmp/$client" $args \
+			>/dev/null 2>"$tmp/stats.out"
+	end=$(date +%s.%N)
+	igd=$(seconds $start $end)
+
+	transl=$(sed -n 's/.*transtab: new *\([0-9,]*\).*/\1/p' "$tmp/stats.out" | tr -d ,)
+	peak=$(sed -n 's/^peak=//p' "$tmp/time.out" 2>/dev/null | awk '{ printf "%.1f", $1 / 1024 }')
+	dump=$(sed -n "s/.*sorted in \([0-9,]*\) ms, written in \([0-9,]*\) ms.*/\1 \2/p" \
+		"$tmp/stats.out" | tr -d , | awk '{ print $1 + $2 }')
+
+	# The entry of the function, as the tool writes the addresses.
+	addr=$(nm "$tmp/$client" | awk -v fn="$fn" '$3 == fn { print $1 }')
+	addr=$(printf "0x%x" "0x$addr")
+	count=$(awk -F: -v addr="$addr" '$1 == addr && $4 == "" { print $3 }' "$tmp/$client.out" 2>/dev/null)
+
+	if [ "${count:-0}" = "$expected" ]; then
+		golden=ok
+	else
+		golden="FAIL ($fn: ${count:-0}, expected $expected)"
+		touch "$tmp/failed"
+	fi
+
+	slowdown=$(awk -v n=$none -v i=$igd 'BEGIN { if (n > 0) printf "%.1fx", i / n; else print "?" }')
+
+	printf "%-10s %-14s %7s %7s %8s %8s %7s %7s  %s\n" \
+		$client "$args" $none $igd $slowdown \
+		"${transl:-?}" "${peak:-?}" "${dump:-?}" "$golden"
+done
+
+[ ! -f "$tmp/failed" ]
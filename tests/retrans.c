@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "instrgrind.h"
+
+// Heavy retranslation: counting is stopped and started every round, and
+// every switch discards all the translations. The work function is called
+// 2 * calls times per round, but only counted while counting is on, so
+// its count is rounds * calls.
+__attribute__((noinline))
+unsigned work(unsigned x) {
+  return (x << 3) ^ (x >> 5) ^ 0x9e3779b9;
+}
+
+int main(int argc, char* argv[]) {
+  int rounds, calls, r, i;
+  unsigned x;
+
+  rounds = argc > 1 ? atoi(argv[1]) : 1000;
+  calls = argc > 2 ? atoi(argv[2]) : 1000;
+
+  x = 1;
+  for (r = 0; r < rounds; r++) {
+    INSTRGRIND_STOP_COUNTING;
+    for (i = 0; i < calls; i++)
+      x = work(x);
+
+    INSTRGRIND_START_COUNTING;
+    for (i = 0; i < calls; i++)
+      x = work(x);
+  }
+
+  printf("%u\n", x);
+
+  return 0;
+}
@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# Compare sampled counting with the exact counts on a client: the wall
+# time of both runs, the error of the total estimated by sampling, and
+# the error per instruction weighted by the exact counts (the sum of the
+# absolute differences over the total).
+#
+#   $ gcc -O2 branchy.c -o branchy
+#   $ ./samplebench.sh ./branchy 10000000
+#
+# The sampling options can be changed with SAMPLE_PERIOD (1000000
+# superblocks by default) and SAMPLE_WINDOW (100000).
+
+VALGRIND=${VALGRIND:-valgrind}
+SAMPLE_PERIOD=${SAMPLE_PERIOD:-1000000}
+SAMPLE_WINDOW=${SAMPLE_WINDOW:-100000}
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <client> [args...]" >&2
+	exit 1
+fi
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+run() {
+	name=$1
+	shift
+
+	start=$(date +%s.%N)
+	$VALGRIND -q --tool=instrgrind --instrs-outfile="$tmp/$name.out" "$@" >/dev/null
+	end=$(date +%s.%N)
+
+	printf "%-8s time %6.2fs\n" $name $(echo "$end - $start" | bc)
+}
+
+run exact "$@"
+run sampled --sample-period=$SAMPLE_PERIOD --sample-window=$SAMPLE_WINDOW "$@"
+
+# The records are keyed by address and generation.
+awk -F: '
+	{ key = $1 ":" ($4 == "" ? 0 : $4) }
+	FILENAME ~ /exact.out$/ { exact[key] = $3; etotal += $3; next }
+	{ sampled[key] = $3; stotal += $3 }
+	END {
+		for (k in exact)
+			diff += (exact[k] > sampled[k]) ? exact[k] - sampled[k] : sampled[k] - exact[k]
+		for (k in sampled)
+			if (!(k in exact))
+				diff += sampled[k]
+
+		printf "total    exact %.0f sampled %.0f error %.2f%%\n",
+			etotal, stotal, etotal ? 100 * (stotal - etotal) / etotal : 0
+		printf "weighted error per instruction %.2f%%\n",
+			etotal ? 100 * diff / etotal : 0
+	}' "$tmp/exact.out" "$tmp/sampled.out"
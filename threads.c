@@ -0,0 +1,292 @@
+/*--------------------------------------------------------------------*/
+/*--- instrgrind                                                   ---*/
+/*---                                                    threads.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of instrgrind, a dynamic instruction tracker tool.
+
+   Copyright (C) 2023, Andrei Rimsa (andrei@cefetmg.br)
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "global.h"
+
+/*
+   Per thread counters (--separate-threads=yes). Each thread has its own
+   array of group counters, indexed by the group id, and the running
+   thread array is published in IGD_(current_counters), which is what the
+   instrumented code increments. The counters are moved to the groups
+   when they are flushed, and also accumulated per instruction in a
+   profile for each thread, to be dumped in separate files.
+*/
+
+#define DEFAULT_CAPACITY 16384 // 16k groups
+#define PROFILE_POOL_SIZE 16384
+#define COUNTS_PER_SLAB 8192
+
+// The counters of the thread running the client code.
+ULong* IGD_(current_counters) = 0;
+
+static ULong* thread_counters[VG_N_THREADS];
+static AddrHash* thread_profiles[VG_N_THREADS]; // UniqueInstr* -> ULong*
+static Int capacity = 0;
+static Slab* counts_slab = 0;
+
+void IGD_(init_threads)() {
+	IGD_ASSERT(counts_slab == 0);
+
+	VG_(memset)(thread_counters, 0, sizeof(thread_counters));
+	VG_(memset)(thread_profiles, 0, sizeof(thread_profiles));
+
+	capacity = DEFAULT_CAPACITY;
+	counts_slab = IGD_(new_slab)("igd.threads.fc.1", sizeof(ULong), COUNTS_PER_SLAB);
+
+	IGD_(current_counters) = 0;
+}
+
+void IGD_(destroy_threads)() {
+	Int t;
+
+	IGD_ASSERT(counts_slab != 0);
+
+	for (t = 0; t < VG_N_THREADS; t++) {
+		if (thread_counters[t]) {
+			IGD_FREE(thread_counters[t]);
+			thread_counters[t] = 0;
+		}
+
+		if (thread_profiles[t]) {
+			IGD_(addr_hash_clear)(thread_profiles[t], 0);
+			IGD_(delete_addr_hash)(thread_profiles[t]);
+			thread_profiles[t] = 0;
+		}
+	}
+
+	IGD_(delete_slab)(counts_slab);
+	counts_slab = 0;
+
+	IGD_(current_counters) = 0;
+}
+
+static
+ULong* new_counters(Int size) {
+	ULong* counters;
+
+	counters = (ULong*) IGD_MALLOC("igd.threads.nc.1", (size * sizeof(ULong)));
+	VG_(memset)(counters, 0, (size * sizeof(ULong)));
+
+	return counters;
+}
+
+// Switch the counters on every thread switch.
+void IGD_(switch_thread)(ThreadId tid) {
+	IGD_ASSERT(tid < VG_N_THREADS);
+
+	if (!thread_counters[tid])
+		thread_counters[tid] = new_counters(capacity);
+
+	IGD_(current_counters) = thread_counters[tid];
+}
+
+// Make room for the counters of the group id. This is only called while
+// instrumenting, so no client code is using the arrays being moved.
+void IGD_(threads_reserve)(UInt id) {
+	Int t, new_capacity;
+
+	if (id < capacity)
+		return;
+
+	new_capacity = capacity;
+	while (id >= new_capacity)
+		new_capacity *= 2;
+
+	for (t = 0; t < VG_N_THREADS; t++) {
+		ULong* counters = thread_counters[t];
+		if (!counters)
+			continue;
+
+		thread_counters[t] = IGD_REALLOC("igd.threads.tr.1", counters,
+									(new_capacity * sizeof(ULong)));
+		VG_(memset)(thread_counters[t] + capacity, 0,
+						((new_capacity - capacity) * sizeof(ULong)));
+
+		if (IGD_(current_counters) == counters)
+			IGD_(current_counters) = thread_counters[t];
+	}
+
+	capacity = new_capacity;
+}
+
+static
+void release_count(ULong* value) {
+	IGD_(slab_free)(counts_slab, value);
+}
+
+// Drop the counters and the profiles of all threads.
+void IGD_(zero_threads)(void) {
+	Int t;
+
+	for (t = 0; t < VG_N_THREADS; t++) {
+		if (thread_counters[t])
+			VG_(memset)(thread_counters[t], 0, (capacity * sizeof(ULong)));
+
+		if (thread_profiles[t])
+			IGD_(addr_hash_clear)(thread_profiles[t], (void (*)(void*)) release_count);
+	}
+}
+
+static
+Bool scale_thread_count(ULong* value, void* arg) {
+	*value = IGD_(sampled_count)(*value);
+	return False;
+}
+
+// Scale the thread profiles of a sampled run (sampling.c).
+void IGD_(scale_threads)(void) {
+	Int t;
+
+	for (t = 0; t < VG_N_THREADS; t++) {
+		if (thread_profiles[t])
+			IGD_(addr_hash_forall)(thread_profiles[t],
+				(Bool (*)(void*, void*)) scale_thread_count, 0);
+	}
+}
+
+static
+void add_thread_count(Int tid, UniqueInstr* instr, ULong count) {
+	ULong* value;
+
+	if (!thread_profiles[tid])
+		thread_profiles[tid] = IGD_(new_addr_hash)(PROFILE_POOL_SIZE);
+
+	value = (ULong*) IGD_(addr_hash_get)(thread_profiles[tid], (Addr) instr);
+	if (!value) {
+		value = (ULong*) IGD_(slab_alloc)(counts_slab);
+		*value = 0;
+
+		IGD_(addr_hash_put)(thread_profiles[tid], (Addr) instr, value);
+	}
+
+	*value += count;
+}
+
+// Move the threads counters of the superblock groups to their execution
+// counts. With exit counters (see blocks.c) the counts of each thread are
+// derived before being added to the thread profile.
+void IGD_(flush_thread_block)(InstrBlock* block) {
+	Int t;
+	UInt i;
+	ULong count, running;
+	InstrGroup* group;
+
+	IGD_ASSERT(block != 0);
+
+	for (t = 0; t < VG_N_THREADS; t++) {
+		if (!thread_counters[t])
+			continue;
+
+		running = 0;
+		for (group = block->groups; group; group = group->next) {
+			IGD_ASSERT(group->id < capacity);
+
+			count = thread_counters[t][group->id];
+			thread_counters[t][group->id] = 0;
+
+			group->exec_count += count;
+
+			if (!IGD_(clo).exit_counters)
+				running = count;
+			else if (group->entry)
+				running = count;
+			else
+				running -= count;
+
+			if (running == 0)
+				continue;
+
+			IGD_(materialize_group)(group);
+
+			for (i = 0; i < group->ninstrs; i++)
+				add_thread_count(t, group->instrs[i], running);
+		}
+	}
+}
+
+typedef struct {
+	Int index;
+	ULong* saved;
+	AddrHash* profile;
+} ThreadDump;
+
+static
+Bool save_instr_count(UniqueInstr* instr, ThreadDump* td) {
+	td->saved[td->index++] = instr->exec_count;
+	return False;
+}
+
+static
+Bool set_thread_count(UniqueInstr* instr, ThreadDump* td) {
+	ULong* value;
+
+	value = (ULong*) IGD_(addr_hash_get)(td->profile, (Addr) instr);
+	instr->exec_count = value ? *value : 0;
+
+	return False;
+}
+
+static
+Bool restore_instr_count(UniqueInstr* instr, ThreadDump* td) {
+	instr->exec_count = td->saved[td->index++];
+	return False;
+}
+
+// Dump one "<filename>-<tid>" file per thread that executed code. The
+// groups must be flushed already.
+void IGD_(dump_threads_instrs)(const HChar* filename) {
+	Int t;
+	HChar* name;
+	ThreadDump td;
+
+	IGD_ASSERT(filename != 0);
+
+	name = (HChar*) IGD_MALLOC("igd.threads.dti.1", VG_(strlen)(filename) + 16);
+
+	td.saved = (ULong*) IGD_MALLOC("igd.threads.dti.2",
+						((IGD_(instrs_count)() + 1) * sizeof(ULong)));
+	td.index = 0;
+	IGD_(forall_instrs)((Bool (*)(UniqueInstr*, void*)) save_instr_count, &td);
+
+	for (t = 0; t < VG_N_THREADS; t++) {
+		if (!thread_profiles[t])
+			continue;
+
+		td.profile = thread_profiles[t];
+		IGD_(forall_instrs)((Bool (*)(UniqueInstr*, void*)) set_thread_count, &td);
+
+		VG_(sprintf)(name, "%s-%02d", filename, t);
+		IGD_(dump_run_instrs)(name);
+	}
+
+	td.index = 0;
+	IGD_(forall_instrs)((Bool (*)(UniqueInstr*, void*)) restore_instr_count, &td);
+
+	IGD_FREE(td.saved);
+	IGD_FREE(name);
+}